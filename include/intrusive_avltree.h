@@ -0,0 +1,138 @@
+#pragma once
+#include "intrusive_bst.h"
+
+// the balance factor lives in the tag bits, the one on the taller side is set
+#define AVLTREE_BALANCE(t) ((int)TREE_TAG(TREE_RIGHT(t)) - (int)TREE_TAG(TREE_LEFT(t)))
+
+// height never exceeds 1.44 * log2(n + 2), one more slot for the head
+#define AVLTREE_MAX_HEIGHT 128
+
+// AVL tree over bare TREE nodes, A keeps a summary per node
+template <typename A> struct basic_avltree : intrusive_bst_base {
+  size_t depth = 0; // height of the whole tree
+
+  void clear() noexcept {
+    root = nullptr;
+    depth = 0;
+  }
+
+  // O(1)
+  size_t height() const noexcept { return depth; }
+
+  // O(log n), down the taller side
+  size_t height(TREE* t) const noexcept {
+    size_t h = 0;
+    while (t != nullptr) {
+      h++;
+      t = child(t, AVLTREE_BALANCE(t) > 0);
+    }
+    return h;
+  }
+
+  // O(log n)
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    tree_path<AVLTREE_MAX_HEIGHT> path(root);
+    path.descend(t, compare);
+    TREE** pa = path.pa;
+    int* da = path.da;
+    int k = path.k;
+
+    TREE_INIT(t);
+    A::update(t);
+    link(pa[k - 1], da[k - 1], t);
+    path.update<A>();
+
+    // the subtree below pa[j] on side da[j] grew by one
+    int j = k - 1;
+    for (; j > 0; j--) {
+      int b = AVLTREE_BALANCE(pa[j]) + (da[j] ? 1 : -1);
+      if (b == 0) {
+        set_balance(pa[j], 0);
+        break;
+      }
+      if (b == 1 || b == -1) {
+        set_balance(pa[j], b);
+        continue;
+      }
+      link(pa[j - 1], da[j - 1], rebalance(pa[j], da[j]));
+      break;
+    }
+    if (j == 0) {
+      depth++;
+    }
+    root = path.root();
+  }
+
+  // O(log n). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    tree_path<AVLTREE_MAX_HEIGHT> path(root);
+    TREE* p = path.find(t, compare);
+    if (p == nullptr) {
+      return nullptr;
+    }
+    TREE* s = path.splice(p);
+    if (s != nullptr) {
+      set_balance(s, AVLTREE_BALANCE(p));
+    }
+    path.update<A>();
+    TREE** pa = path.pa;
+    int* da = path.da;
+    int k = path.k;
+
+    // the subtree below pa[j] on side da[j] shrank by one
+    int j = k - 1;
+    for (; j > 0; j--) {
+      int b = AVLTREE_BALANCE(pa[j]) - (da[j] ? 1 : -1);
+      if (b == 1 || b == -1) {
+        set_balance(pa[j], b);
+        break;
+      }
+      if (b == 0) {
+        set_balance(pa[j], 0);
+        continue;
+      }
+      TREE* c = child(pa[j], !da[j]);
+      bool shorter = AVLTREE_BALANCE(c) != 0;
+      link(pa[j - 1], da[j - 1], rebalance(pa[j], !da[j]));
+      if (!shorter) {
+        break;
+      }
+    }
+    if (j == 0) {
+      depth--;
+    }
+    root = path.root();
+    TREE_INIT(p);
+    return p;
+  }
+
+private:
+  static void set_balance(TREE* t, int b) noexcept {
+    TREE_LEFT(t) = (TREE*)((uintptr_t)TREE_LCHILD(t) | (b < 0 ? TREE_TAG_MASK : 0));
+    TREE_RIGHT(t) = (TREE*)((uintptr_t)TREE_RCHILD(t) | (b > 0 ? TREE_TAG_MASK : 0));
+  }
+
+  // t leans two deeper towards dir, returns the node taking its place
+  static TREE* rebalance(TREE* t, int dir) noexcept {
+    int sign = dir ? 1 : -1;
+    TREE* c = child(t, dir);
+    int bc = AVLTREE_BALANCE(c) * sign;
+    if (bc >= 0) {
+      rotate<A>(t, !dir);
+      set_balance(t, bc == 0 ? sign : 0);
+      set_balance(c, bc == 0 ? -sign : 0);
+      return c;
+    }
+    TREE* g = child(c, !dir);
+    int bg = AVLTREE_BALANCE(g) * sign;
+    link(t, dir, rotate<A>(c, dir));
+    rotate<A>(t, !dir);
+    set_balance(t, bg > 0 ? -sign : 0);
+    set_balance(c, bg < 0 ? sign : 0);
+    set_balance(g, 0);
+    return g;
+  }
+};
+
+typedef basic_avltree<tree_no_augment> intrusive_avltree;
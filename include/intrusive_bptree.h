@@ -0,0 +1,429 @@
+#pragma once
+#include <functional>
+
+#include "intrusive_bst.h"
+
+// what an object carries to be in an intrusive_bptree, the leaf holding it or nullptr when it is in none
+typedef void* BPTREE[1];
+#define BPTREE_LEAF(b) (((void**)(b))[0])
+#define BPTREE_INIT(b) (BPTREE_LEAF(b) = nullptr)
+
+// blocks of E carved out of chunks of this many, handed back to a free list and released all together
+#define BPTREE_POOL_CHUNK 64
+
+template <typename E> struct bptree_pool {
+  basic_tree_stack<E*> chunks;
+  E* spare;    // free list threaded through the first word of each block
+  size_t used; // blocks taken from the last chunk
+
+  bptree_pool() : spare(nullptr), used(BPTREE_POOL_CHUNK) {}
+  bptree_pool(const bptree_pool&) = delete;
+  bptree_pool& operator=(const bptree_pool&) = delete;
+  ~bptree_pool() { clear(); }
+
+  E* get() noexcept {
+    if (spare != nullptr) {
+      E* e = spare;
+      spare = *(E**)e;
+      return e;
+    }
+    if (used == BPTREE_POOL_CHUNK) {
+      E* c = (E*)malloc(BPTREE_POOL_CHUNK * sizeof(E));
+      assert(c != nullptr);
+      chunks.push(c);
+      used = 0;
+    }
+    return chunks.top() + used++;
+  }
+
+  void put(E* e) noexcept {
+    *(E**)e = spare;
+    spare = e;
+  }
+
+  void clear() noexcept {
+    while (!chunks.empty()) {
+      free(chunks.pop());
+    }
+    spare = nullptr;
+    used = BPTREE_POOL_CHUNK;
+  }
+};
+
+// B+tree over objects carrying a BPTREE, leaves keep copies of the keys. Below the root every node stays at least half
+// full, an erase that would leave it less borrows from a sibling or merges with it, so height stays log_{B/2} n
+template <typename K, typename Compare = std::less<K>, unsigned B = 64> struct intrusive_bptree {
+  static_assert(std::is_trivially_copyable<K>::value, "K is kept in raw memory");
+  static_assert(B >= 4, "a node splits in two halves of at least 2");
+
+  struct inner;
+
+  struct node {
+    inner* parent;
+  };
+
+  struct leaf : node {
+    leaf* prev;
+    leaf* next;
+    unsigned n;
+    K keys[B];
+    BPTREE* items[B];
+  };
+
+  // child i holds keys between keys[i - 1] and keys[i], both included since equal keys may straddle a split
+  struct inner : node {
+    unsigned n;
+    K keys[B - 1];
+    node* children[B];
+  };
+
+  node* root;
+  leaf* head;
+  unsigned levels; // leaves are levels - 1 down from the root, 0 when empty
+  Compare compare;
+
+  intrusive_bptree() : root(nullptr), head(nullptr), levels(0), compare(), count(0) {}
+  explicit intrusive_bptree(const Compare& c) : root(nullptr), head(nullptr), levels(0), compare(c), count(0) {}
+  intrusive_bptree(const intrusive_bptree&) = delete;
+  intrusive_bptree& operator=(const intrusive_bptree&) = delete;
+  ~intrusive_bptree() { unhook(); }
+
+  bool empty() const noexcept { return root == nullptr; }
+  size_t size() const noexcept { return count; }
+  size_t height() const noexcept { return levels; }
+
+  // O(n), every hook is reset and every node goes back to the pools
+  void clear() noexcept {
+    unhook();
+    leaves.clear();
+    inners.clear();
+    root = nullptr;
+    head = nullptr;
+    levels = 0;
+    count = 0;
+  }
+
+  // O(B log_B n), b after any object with a key equal to key
+  void insert(BPTREE* b, const K& key) {
+    if (root == nullptr) {
+      head = make_leaf();
+      root = head;
+      levels = 1;
+    }
+    leaf* l = descend<1>(key);
+    unsigned i = rank<1>(l->keys, l->n, key);
+    if (l->n == B) {
+      leaf* r = split(l);
+      if (i > l->n) {
+        i -= l->n;
+        l = r;
+      }
+    }
+    memmove((void*)&l->keys[i + 1], (const void*)&l->keys[i], (l->n - i) * sizeof(K));
+    memmove(&l->items[i + 1], &l->items[i], (l->n - i) * sizeof(BPTREE*));
+    memcpy((void*)&l->keys[i], (const void*)&key, sizeof(K));
+    l->items[i] = b;
+    l->n++;
+    BPTREE_LEAF(b) = l;
+    count++;
+  }
+
+  // O(B) through the hook, O(B log_B n) when merges climb to the root. Removes b itself, returns it or nullptr
+  BPTREE* erase(BPTREE* b) noexcept {
+    leaf* l = (leaf*)BPTREE_LEAF(b);
+    if (l == nullptr) {
+      return nullptr;
+    }
+    unsigned i = 0;
+    while (l->items[i] != b) {
+      i++;
+    }
+    l->n--;
+    memmove((void*)&l->keys[i], (const void*)&l->keys[i + 1], (l->n - i) * sizeof(K));
+    memmove(&l->items[i], &l->items[i + 1], (l->n - i) * sizeof(BPTREE*));
+    BPTREE_INIT(b);
+    count--;
+    underflow(l);
+    return b;
+  }
+
+  // O(B log_B n). Removes the first object with key, returns it or nullptr
+  BPTREE* erase(const K& key) noexcept {
+    BPTREE* b = find(key);
+    return b != nullptr ? erase(b) : nullptr;
+  }
+
+  // the first object with key or nullptr, O(log B log_B n)
+  BPTREE* find(const K& key) const noexcept {
+    leaf* l;
+    unsigned i;
+    if (!bound<0>(key, l, i)) {
+      return nullptr;
+    }
+    return compare(key, l->keys[i]) ? nullptr : l->items[i];
+  }
+
+  // first object whose key is not ordered before key and first one whose key is ordered after it
+  BPTREE* lower_bound(const K& key) const noexcept {
+    leaf* l;
+    unsigned i;
+    return bound<0>(key, l, i) ? l->items[i] : nullptr;
+  }
+
+  BPTREE* upper_bound(const K& key) const noexcept {
+    leaf* l;
+    unsigned i;
+    return bound<1>(key, l, i) ? l->items[i] : nullptr;
+  }
+
+  // in order along the leaf chain, stops once f returns false
+  template <typename F, typename... Args> void iterate(F&& f, Args&&... args) const noexcept {
+    for (leaf* l = head; l != nullptr; l = l->next) {
+      for (unsigned i = 0; i < l->n; i++) {
+        if (!tree_visit(f, l->items[i], args...)) {
+          return;
+        }
+      }
+    }
+  }
+
+private:
+  size_t count;
+  bptree_pool<leaf> leaves;
+  bptree_pool<inner> inners;
+
+  void unhook() noexcept {
+    for (leaf* l = head; l != nullptr; l = l->next) {
+      for (unsigned i = 0; i < l->n; i++) {
+        BPTREE_INIT(l->items[i]);
+      }
+    }
+  }
+
+  // first of keys[0, n) ordered after key for upper, not ordered before it otherwise
+  template <int upper> unsigned rank(const K* keys, unsigned n, const K& key) const noexcept {
+    unsigned lo = 0;
+    while (n > 0) {
+      unsigned h = n / 2;
+      bool right = upper ? !compare(key, keys[lo + h]) : compare(keys[lo + h], key);
+      lo = right ? lo + h + 1 : lo;
+      n = right ? n - h - 1 : h;
+    }
+    return lo;
+  }
+
+  // the leaf key goes in, before or after its equals for upper
+  template <int upper> leaf* descend(const K& key) const noexcept {
+    node* p = root;
+    for (unsigned d = 1; d < levels; d++) {
+      inner* in = static_cast<inner*>(p);
+      p = in->children[rank<upper>(in->keys, in->n - 1, key)];
+    }
+    return static_cast<leaf*>(p);
+  }
+
+  // slot i of leaf l holding the bound, false past the last key
+  template <int upper> bool bound(const K& key, leaf*& l, unsigned& i) const noexcept {
+    if (root == nullptr) {
+      return false;
+    }
+    l = descend<upper>(key);
+    i = rank<upper>(l->keys, l->n, key);
+    if (i == l->n) {
+      l = l->next;
+      i = 0;
+    }
+    return l != nullptr;
+  }
+
+  leaf* make_leaf() noexcept {
+    leaf* l = leaves.get();
+    l->parent = nullptr;
+    l->prev = nullptr;
+    l->next = nullptr;
+    l->n = 0;
+    return l;
+  }
+
+  // moves the upper half of full l to a new leaf chained after it and returned, their hooks follow
+  leaf* split(leaf* l) noexcept {
+    leaf* r = make_leaf();
+    unsigned m = B / 2;
+    r->n = B - m;
+    memcpy((void*)r->keys, (const void*)&l->keys[m], r->n * sizeof(K));
+    memcpy(r->items, &l->items[m], r->n * sizeof(BPTREE*));
+    for (unsigned i = 0; i < r->n; i++) {
+      BPTREE_LEAF(r->items[i]) = r;
+    }
+    l->n = m;
+    r->prev = l;
+    r->next = l->next;
+    if (r->next != nullptr) {
+      r->next->prev = r;
+    }
+    l->next = r;
+    hang(l, r, r->keys[0]);
+    return r;
+  }
+
+  // right goes next to left in their parent with sep between them, splitting the parent first if it is full
+  void hang(node* left, node* right, K sep) noexcept {
+    inner* p = left->parent;
+    if (p == nullptr) {
+      p = inners.get();
+      p->parent = nullptr;
+      p->n = 1;
+      p->children[0] = left;
+      left->parent = p;
+      root = p;
+      levels++;
+    } else if (p->n == B) {
+      split(p);
+      p = left->parent;
+    }
+    unsigned j = 0;
+    while (p->children[j] != left) {
+      j++;
+    }
+    memmove((void*)&p->keys[j + 1], (const void*)&p->keys[j], (p->n - 1 - j) * sizeof(K));
+    memmove(&p->children[j + 2], &p->children[j + 1], (p->n - 1 - j) * sizeof(node*));
+    memcpy((void*)&p->keys[j], (const void*)&sep, sizeof(K));
+    p->children[j + 1] = right;
+    right->parent = p;
+    p->n++;
+  }
+
+  // the upper half of full p to a new inner node, the key between the halves goes up
+  void split(inner* p) noexcept {
+    inner* q = inners.get();
+    unsigned m = B / 2;
+    q->n = B - m;
+    memcpy(q->children, &p->children[m], q->n * sizeof(node*));
+    memcpy((void*)q->keys, (const void*)&p->keys[m], (q->n - 1) * sizeof(K));
+    for (unsigned j = 0; j < q->n; j++) {
+      q->children[j]->parent = q;
+    }
+    p->n = m;
+    hang(p, q, p->keys[m - 1]);
+  }
+
+  // index of child c in p
+  static unsigned slot(const inner* p, const node* c) noexcept {
+    unsigned j = 0;
+    while (p->children[j] != c) {
+      j++;
+    }
+    return j;
+  }
+
+  // l under half full takes the nearest key of a sibling that can spare one, or else merges with it. An empty root
+  // leaf goes
+  void underflow(leaf* l) noexcept {
+    inner* p = l->parent;
+    if (p == nullptr) {
+      if (l->n == 0) {
+        leaves.put(l);
+        root = nullptr;
+        head = nullptr;
+        levels = 0;
+      }
+      return;
+    }
+    if (l->n >= B / 2) {
+      return;
+    }
+    unsigned j = slot(p, l);
+    leaf* s = j > 0 ? l->prev : l->next;
+    if (s->n > B / 2) {
+      unsigned i = j > 0 ? s->n - 1 : 0;
+      unsigned at = j > 0 ? 0 : l->n;
+      memmove((void*)&l->keys[at + 1], (const void*)&l->keys[at], (l->n - at) * sizeof(K));
+      memmove(&l->items[at + 1], &l->items[at], (l->n - at) * sizeof(BPTREE*));
+      memcpy((void*)&l->keys[at], (const void*)&s->keys[i], sizeof(K));
+      l->items[at] = s->items[i];
+      BPTREE_LEAF(l->items[at]) = l;
+      l->n++;
+      s->n--;
+      memmove((void*)&s->keys[i], (const void*)&s->keys[i + 1], (s->n - i) * sizeof(K));
+      memmove(&s->items[i], &s->items[i + 1], (s->n - i) * sizeof(BPTREE*));
+      // the separator becomes the first key of whichever of the two is on the right
+      if (j > 0) {
+        memcpy((void*)&p->keys[j - 1], (const void*)&l->keys[0], sizeof(K));
+      } else {
+        memcpy((void*)&p->keys[0], (const void*)&s->keys[0], sizeof(K));
+      }
+      return;
+    }
+
+    // the right one of the two empties into the left one, which keeps its place in the chain
+    leaf* a = j > 0 ? s : l;
+    leaf* r = j > 0 ? l : s;
+    memcpy((void*)&a->keys[a->n], (const void*)r->keys, r->n * sizeof(K));
+    memcpy(&a->items[a->n], r->items, r->n * sizeof(BPTREE*));
+    for (unsigned i = 0; i < r->n; i++) {
+      BPTREE_LEAF(r->items[i]) = a;
+    }
+    a->n += r->n;
+    a->next = r->next;
+    if (a->next != nullptr) {
+      a->next->prev = a;
+    }
+    leaves.put(r);
+    unhang(p, j > 0 ? j - 1 : 0);
+  }
+
+  // takes key i and child i + 1 out of p, then p borrows or merges in turn. A root left with one child gives way to it
+  void unhang(inner* p, unsigned i) noexcept {
+    memmove((void*)&p->keys[i], (const void*)&p->keys[i + 1], (p->n - 2 - i) * sizeof(K));
+    memmove(&p->children[i + 1], &p->children[i + 2], (p->n - 2 - i) * sizeof(node*));
+    p->n--;
+    inner* q = p->parent;
+    if (q == nullptr) {
+      if (p->n == 1) {
+        root = p->children[0];
+        root->parent = nullptr;
+        inners.put(p);
+        levels--;
+      }
+      return;
+    }
+    if (p->n >= B / 2) {
+      return;
+    }
+
+    // keys rotate through the separator in q, children move as they are
+    unsigned j = slot(q, p);
+    inner* s = static_cast<inner*>(q->children[j > 0 ? j - 1 : j + 1]);
+    if (s->n > B / 2) {
+      if (j > 0) {
+        memmove((void*)&p->keys[1], (const void*)&p->keys[0], (p->n - 1) * sizeof(K));
+        memmove(&p->children[1], &p->children[0], p->n * sizeof(node*));
+        memcpy((void*)&p->keys[0], (const void*)&q->keys[j - 1], sizeof(K));
+        p->children[0] = s->children[s->n - 1];
+        memcpy((void*)&q->keys[j - 1], (const void*)&s->keys[s->n - 2], sizeof(K));
+      } else {
+        memcpy((void*)&p->keys[p->n - 1], (const void*)&q->keys[0], sizeof(K));
+        p->children[p->n] = s->children[0];
+        memcpy((void*)&q->keys[0], (const void*)&s->keys[0], sizeof(K));
+        memmove((void*)&s->keys[0], (const void*)&s->keys[1], (s->n - 2) * sizeof(K));
+        memmove(&s->children[0], &s->children[1], (s->n - 1) * sizeof(node*));
+      }
+      (j > 0 ? p->children[0] : p->children[p->n])->parent = p;
+      p->n++;
+      s->n--;
+      return;
+    }
+    inner* a = j > 0 ? s : p;
+    inner* r = j > 0 ? p : s;
+    unsigned k = j > 0 ? j - 1 : 0;
+    memcpy((void*)&a->keys[a->n - 1], (const void*)&q->keys[k], sizeof(K));
+    memcpy((void*)&a->keys[a->n], (const void*)r->keys, (r->n - 1) * sizeof(K));
+    memcpy(&a->children[a->n], r->children, r->n * sizeof(node*));
+    for (unsigned c = 0; c < r->n; c++) {
+      r->children[c]->parent = a;
+    }
+    a->n += r->n;
+    inners.put(r);
+    unhang(q, k);
+  }
+};
@@ -1,7 +1,12 @@
 #pragma once
+#include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-#include <deque>
+#include <type_traits>
+#include <utility>
 
 typedef void* TREE[2];
 #define TREE_LEFT(t) (*(TREE**)&((*(t))[0]))
@@ -15,11 +20,23 @@ typedef void* TREE[2];
 
 #define TREE_DATA(ptr, type, field) ((type*)((char*)(ptr)-offsetof(type, field)))
 
-#define LEFT_EMPTY(t) ((const TREE*)(t) == (const TREE*)TREE_LEFT(t))
-#define RIGHT_EMPTY(t) ((const TREE*)(t) == (const TREE*)TREE_RIGHT(t))
+// bit 0 of each link is a tag for the balanced variants, read and write links through these
+#define TREE_TAG_MASK ((uintptr_t)1)
+#define TREE_PTR(p) ((TREE*)((uintptr_t)(p) & ~TREE_TAG_MASK))
+#define TREE_TAG(p) ((uintptr_t)(p)&TREE_TAG_MASK)
+#define TREE_LCHILD(t) TREE_PTR(TREE_LEFT(t))
+#define TREE_RCHILD(t) TREE_PTR(TREE_RIGHT(t))
+#define TREE_SET_LCHILD(t, c) (TREE_LEFT(t) = (TREE*)((uintptr_t)(c) | TREE_TAG(TREE_LEFT(t))))
+#define TREE_SET_RCHILD(t, c) (TREE_RIGHT(t) = (TREE*)((uintptr_t)(c) | TREE_TAG(TREE_RIGHT(t))))
+
+#define LEFT_EMPTY(t) ((const TREE*)(t) == (const TREE*)TREE_LCHILD(t))
+#define RIGHT_EMPTY(t) ((const TREE*)(t) == (const TREE*)TREE_RCHILD(t))
 #define TREE_EMPTY(t) (LEFT_EMPTY(t) && RIGHT_EMPTY(t))
 
+// insert takes a less(TREE*, TREE*), as a TREE_LESS_T or an inlined functor
+// erase and insert_unique also take a three-way compare returning <0, 0 or >0, wrapped by tree_compare
 typedef bool (*TREE_LESS_T)(TREE*, TREE*);
+typedef int (*TREE_COMPARE_T)(TREE*, TREE*);
 typedef enum {
   TREE_TRAVERSE_PREORDER,
   TREE_TRAVERSE_INORDER,
@@ -27,7 +44,203 @@ typedef enum {
   TREE_TRAVERSE_BFS,
 } tree_traverse_t;
 
+// A::update(t) recomputes a summary in t whenever its children change
+struct tree_no_augment {
+  static void update(TREE* t) noexcept {}
+};
+
+// a walk stops once f returns false, an f returning void sees every node
+template <typename F, typename N, typename... Args>
+inline auto tree_visit(F& f, N* t, Args&... args) ->
+    typename std::enable_if<!std::is_void<decltype(f(t, args...))>::value, bool>::type {
+  return f(t, args...);
+}
+
+template <typename F, typename N, typename... Args>
+inline auto tree_visit(F& f, N* t, Args&... args) ->
+    typename std::enable_if<std::is_void<decltype(f(t, args...))>::value, bool>::type {
+  f(t, args...);
+  return true;
+}
+
+// a comparator is three-way only when marked so, by deriving from tree_three_way_tag or through tree_compare
+struct tree_three_way_tag {};
+
+template <typename C> struct tree_three_way_compare : tree_three_way_tag {
+  C compare;
+  explicit tree_three_way_compare(const C& c) : compare(c) {}
+  int operator()(TREE* t1, TREE* t2) const { return int(compare(t1, t2)); }
+};
+
+template <typename C> tree_three_way_compare<typename std::decay<C>::type> tree_compare(C&& compare) {
+  return tree_three_way_compare<typename std::decay<C>::type>(compare);
+}
+
+template <typename L> struct tree_three_way {
+  static const bool value = std::is_base_of<tree_three_way_tag, typename std::decay<L>::type>::value;
+};
+
+// for the entry points that only take a less
+#define TREE_ASSERT_LESS(L) static_assert(!tree_three_way<L>::value, "a less is needed, not a three-way compare")
+
+// <0, 0 or >0 as t1 goes before, with or after t2
+template <typename L> inline int tree_order(L& compare, TREE* t1, TREE* t2) {
+  if (tree_three_way<L>::value) {
+    return int(compare(t1, t2));
+  }
+  return compare(t1, t2) ? -1 : (compare(t2, t1) ? 1 : 0);
+}
+
+// heap for walks that outgrow their inline scratch space, define both to redirect it
+#ifndef TREE_MALLOC
+#define TREE_MALLOC malloc
+#define TREE_FREE free
+#endif
+
+#define TREE_STACK_INLINE 64
+
+// stack for the iterative walks, spills to the heap past TREE_STACK_INLINE deep
+template <typename E> struct basic_tree_stack {
+  E es[TREE_STACK_INLINE];
+  E* base;
+  E* cap;
+  E* sp;
+
+  basic_tree_stack() : base(es), cap(es + TREE_STACK_INLINE), sp(es) {}
+  basic_tree_stack(const basic_tree_stack& s) : base(es), cap(es + TREE_STACK_INLINE), sp(es) { assign(s); }
+  basic_tree_stack& operator=(const basic_tree_stack& s) {
+    if (this != &s) {
+      assign(s);
+    }
+    return *this;
+  }
+  ~basic_tree_stack() {
+    if (base != es) {
+      TREE_FREE(base);
+    }
+  }
+
+  bool empty() const noexcept { return sp == base; }
+  size_t size() const noexcept { return size_t(sp - base); }
+  E top() const noexcept { return sp[-1]; }
+  E pop() noexcept { return *--sp; }
+  void clear() noexcept { sp = base; }
+  void truncate(size_t n) noexcept { sp = base + n; }
+
+  void push(E e) noexcept {
+    if (sp == cap) {
+      grow(size() + 1);
+    }
+    *sp++ = e;
+  }
+
+private:
+  void assign(const basic_tree_stack& s) noexcept {
+    size_t n = s.size();
+    if (n > size_t(cap - base)) {
+      grow(n);
+    }
+    memcpy(base, s.base, n * sizeof(E));
+    sp = base + n;
+  }
+
+  void grow(size_t need) noexcept {
+    size_t n = size();
+    size_t c = 2 * size_t(cap - base);
+    while (c < need) {
+      c *= 2;
+    }
+    E* b = (E*)TREE_MALLOC(c * sizeof(E));
+    assert(b != nullptr);
+    memcpy(b, base, n * sizeof(E));
+    if (base != es) {
+      TREE_FREE(base);
+    }
+    base = b;
+    cap = b + c;
+    sp = b + n;
+  }
+};
+
+typedef basic_tree_stack<TREE*> tree_stack;
+
+struct tree_depth {
+  TREE* t;
+  size_t depth;
+};
+
+#define TREE_BFS_INLINE 256
+
 struct intrusive_bst {
+  // bidirectional in-order, amortized O(1) steps. It keeps the path from the root, empty at end()
+  // The path is inline up to TREE_STACK_INLINE deep, deeper unbalanced trees spill it to the heap
+  struct iterator {
+    const intrusive_bst* tree;
+    tree_stack path;
+
+    // what it++ and it-- return, the node stepped from without a copy of the path
+    struct stepped {
+      TREE* t;
+      TREE* operator*() const noexcept { return t; }
+    };
+
+    explicit iterator(const intrusive_bst* t) : tree(t) {}
+
+    bool operator==(const iterator& i) const noexcept { return node() == i.node(); }
+    bool operator!=(const iterator& i) const noexcept { return node() != i.node(); }
+    TREE* operator*() const noexcept { return node(); }
+    TREE* node() const noexcept { return path.empty() ? nullptr : path.top(); }
+
+    iterator& operator++() noexcept {
+      if (!path.empty()) {
+        step(1);
+      }
+      return *this;
+    }
+
+    stepped operator++(int) noexcept {
+      stepped i{node()};
+      ++(*this);
+      return i;
+    }
+
+    // --end() is the last node
+    iterator& operator--() noexcept {
+      if (!path.empty()) {
+        step(0);
+      } else if (tree->root != nullptr) {
+        descend(tree->root, 1);
+      }
+      return *this;
+    }
+
+    stepped operator--(int) noexcept {
+      stepped i{node()};
+      --(*this);
+      return i;
+    }
+
+    // pushes t and the nodes down its dir side
+    void descend(TREE* t, int dir) noexcept {
+      for (; t != nullptr; t = child(t, dir)) {
+        path.push(t);
+      }
+    }
+
+  private:
+    // next node towards dir
+    void step(int dir) noexcept {
+      TREE* c = child(path.top(), dir);
+      if (c != nullptr) {
+        descend(c, !dir);
+        return;
+      }
+      do {
+        c = path.pop();
+      } while (!path.empty() && child(path.top(), dir) == c);
+    }
+  };
+
   TREE* root;
 
   intrusive_bst() : root(nullptr) {}
@@ -36,23 +249,35 @@ struct intrusive_bst {
 
   void clear() { root = nullptr; }
 
-  void insert(TREE* r, TREE* t, TREE_LESS_T compare) {
-    if (compare(t, r)) {
-      if (LEFT_EMPTY(r)) {
-        TREE_LEFT(r) = t;
-        return;
-      }
-      insert(TREE_LEFT(r), t, compare);
+  // dir 0 is left and 1 is right, nullptr when empty, tags untouched
+  static TREE* child(TREE* t, int dir) noexcept {
+    TREE* c = dir ? TREE_RCHILD(t) : TREE_LCHILD(t);
+    return c == t ? nullptr : c;
+  }
+
+  static void link(TREE* t, int dir, TREE* c) noexcept {
+    if (dir) {
+      TREE_SET_RCHILD(t, c != nullptr ? c : t);
     } else {
-      if (RIGHT_EMPTY(r)) {
-        TREE_RIGHT(r) = t;
+      TREE_SET_LCHILD(t, c != nullptr ? c : t);
+    }
+  }
+
+  template <typename L> void insert(TREE* r, TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    for (;;) {
+      int dir = !compare(t, r);
+      TREE* c = child(r, dir);
+      if (c == nullptr) {
+        link(r, dir, t);
         return;
       }
-      insert(TREE_RIGHT(r), t, compare);
+      r = c;
     }
   }
 
-  void insert(TREE* t, TREE_LESS_T compare) {
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
     if (!empty()) {
       insert(root, t, compare);
     } else {
@@ -60,44 +285,150 @@ struct intrusive_bst {
     }
   }
 
-  void erase(TREE** r, TREE* p, TREE* t, TREE_LESS_T compare) {
-    bool less = compare(t, *r);
-    if (less && !LEFT_EMPTY(*r)) {
-      erase(&TREE_LEFT(*r), *r, t, compare);
+  // O(height). Links t unless an equal node is in, returns t or that node
+  template <typename L> TREE* insert_unique(TREE* t, L&& compare) {
+    TREE* parent = nullptr;
+    TREE* e = nullptr;
+    int dir = 0;
+    for (TREE* p = root; p != nullptr; p = child(p, dir)) {
+      dir = probe(compare, t, p, e);
+      if (dir < 0) {
+        return p;
+      }
+      parent = p;
     }
-    bool greater = compare(*r, t);
-    if (greater && !RIGHT_EMPTY(*r)) {
-      erase(&TREE_RIGHT(*r), *r, t, compare);
+    if (found(compare, t, e)) {
+      return e;
     }
+    TREE_INIT(t);
+    if (parent != nullptr) {
+      link(parent, dir, t);
+    } else {
+      root = t;
+    }
+    return t;
+  }
 
-    if (!less && !greater) {
-      std::deque<TREE*> ts;
-      auto collect = [&ts](TREE* t) { ts.push_back(t); };
-      if (!LEFT_EMPTY(*r)) {
-        iterate_postorder(collect, TREE_LEFT(*r));
+  // t as close before hint as order allows. O(height), a couple of comparisons when t belongs right before hint
+  // The path of hint is reused in place and left at t. A hint at end() stays there when t goes last
+  template <typename L> void insert_hint(iterator& hint, TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    if (*hint == nullptr && !empty()) { // down the right spine without the path, t most likely goes last
+      TREE* m = max(root);
+      if (!compare(t, m)) {
+        TREE_INIT(t);
+        link(m, 1, t);
+        return;
+      }
+    }
+    int dir = locate(hint, t, compare);
+    TREE_INIT(t);
+    if (!hint.path.empty()) {
+      link(hint.path.top(), dir, t);
+    } else {
+      root = t;
+    }
+    hint.path.push(t);
+  }
+
+  template <typename L> void insert_hint(iterator&& hint, TREE* t, L&& compare) { insert_hint(hint, t, compare); }
+
+  // t, not before any node, after the last one with no comparison. last is at the last node or end(), left at t
+  void insert_max(iterator& last, TREE* t) noexcept {
+    TREE_INIT(t);
+    if (empty()) {
+      root = t;
+      last.path.clear();
+    } else {
+      if (last.path.empty()) {
+        last.descend(root, 1);
       }
-      if (!RIGHT_EMPTY(*r)) {
-        iterate_postorder(collect, TREE_RIGHT(*r));
+      assert(RIGHT_EMPTY(last.path.top()));
+      link(last.path.top(), 1, t);
+    }
+    last.path.push(t);
+  }
+
+  // O(height). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    TREE* parent = nullptr;
+    TREE* p = root;
+    int dir = 0;
+    while (p != nullptr) {
+      int o = tree_order(compare, t, p);
+      if (o == 0) {
+        break;
       }
-      if (ts.size() > 0) {
-        intrusive_bst sub;
-        for (TREE* x : ts) {
-          TREE_INIT(x);
-          sub.insert(x, compare);
-        }
-        *r = sub.root;
-      } else {
-        *r = p;
+      dir = o > 0;
+      parent = p;
+      p = child(p, dir);
+    }
+    if (p == nullptr) {
+      return nullptr;
+    }
+
+    TREE* l = child(p, 0);
+    TREE* r = child(p, 1);
+    TREE* s = l == nullptr ? r : l;
+    if (l != nullptr && r != nullptr) { // splice the successor into p's place
+      TREE* sp = p;
+      s = r;
+      while (child(s, 0) != nullptr) {
+        sp = s;
+        s = child(s, 0);
+      }
+      if (sp != p) {
+        link(sp, 0, child(s, 1));
+        link(s, 1, r);
       }
+      link(s, 0, l);
     }
+
+    if (parent != nullptr) {
+      link(parent, dir, s);
+    } else {
+      root = s;
+    }
+    TREE_INIT(p);
+    return p;
   }
 
-  void erase(TREE* t, TREE_LESS_T compare) { erase(&root, root, t, compare); }
+  // Day-Stout-Warren rebuild of the nodes below t, returns the new root. O(n) time, O(1) memory, a single walk
+  // Tags are kept as they were, so variant colors or balances become meaningless
+  static TREE* balance(TREE* t) noexcept {
+    TREE head;
+    TREE_INIT(&head);
+    link(&head, 1, t);
+    size_t n = 0; // counted as the vine grows
+    for (TREE *tail = &head, *rest = t; rest != nullptr;) {
+      TREE* l = child(rest, 0);
+      if (l == nullptr) {
+        tail = rest;
+        rest = child(rest, 1);
+        n++;
+      } else {
+        link(rest, 0, child(l, 1));
+        link(l, 1, rest);
+        link(tail, 1, l);
+        rest = l;
+      }
+    }
+
+    size_t full = 0; // nodes of the largest complete tree that fits
+    while (2 * full + 1 <= n) {
+      full = 2 * full + 1;
+    }
+    compress(&head, n - full);
+    for (size_t m = full / 2; m > 0; m /= 2) {
+      compress(&head, m);
+    }
+    return child(&head, 1);
+  }
 
   TREE* min(TREE* r) const noexcept {
     TREE* t = r;
     while (t != nullptr && !LEFT_EMPTY(t)) {
-      t = TREE_LEFT(t);
+      t = TREE_LCHILD(t);
     }
     return t;
   }
@@ -105,46 +436,266 @@ struct intrusive_bst {
   TREE* max(TREE* r) const noexcept {
     TREE* t = r;
     while (t != nullptr && !RIGHT_EMPTY(t)) {
-      t = TREE_RIGHT(t);
+      t = TREE_RCHILD(t);
     }
     return t;
   }
 
+  // lookups take a key and compare(key, t) returning <0, 0 or >0. All O(height), nullptr when none
+
+  // one node equal to key
+  template <typename K, typename C> TREE* find(const K& key, C&& compare) const noexcept {
+    TREE* t = root;
+    while (t != nullptr) {
+      int c = compare(key, t);
+      if (c == 0) {
+        return t;
+      }
+      t = child(t, c > 0);
+    }
+    return nullptr;
+  }
+
+  // first node not ordered before key
+  template <typename K, typename C> TREE* lower_bound(const K& key, C&& compare) const noexcept {
+    return lower_bound(root, key, compare);
+  }
+
+  // first node ordered after key
+  template <typename K, typename C> TREE* upper_bound(const K& key, C&& compare) const noexcept {
+    return upper_bound(root, key, compare);
+  }
+
+  // [lower_bound, upper_bound)
+  template <typename K, typename C> std::pair<TREE*, TREE*> equal_range(const K& key, C&& compare) const noexcept {
+    TREE* t = root;
+    TREE* hi = nullptr;
+    while (t != nullptr) {
+      int c = compare(key, t);
+      if (c < 0) {
+        hi = t;
+        t = child(t, 0);
+      } else if (c > 0) {
+        t = child(t, 1);
+      } else {
+        TREE* l = lower_bound(child(t, 0), key, compare);
+        TREE* u = upper_bound(child(t, 1), key, compare);
+        return std::make_pair(l != nullptr ? l : t, u != nullptr ? u : hi);
+      }
+    }
+    return std::make_pair(hi, hi);
+  }
+
+  iterator begin() const noexcept {
+    iterator i(this);
+    i.descend(root, 0);
+    return i;
+  }
+
+  iterator end() const noexcept { return iterator(this); }
+
+  // iterator at lower_bound(key), for range scans
+  template <typename K, typename C> iterator begin(const K& key, C&& compare) const noexcept {
+    iterator i(this);
+    size_t n = 0;
+    for (TREE* t = root; t != nullptr;) {
+      i.path.push(t);
+      if (compare(key, t) <= 0) {
+        n = i.path.size();
+        t = child(t, 0);
+      } else {
+        t = child(t, 1);
+      }
+    }
+    i.path.truncate(n);
+    return i;
+  }
+
+  // iterator at t itself, end() if t is not in. O(height) plus a step per equal node ahead of t
+  template <typename L> iterator iterator_to(TREE* t, L&& compare) const noexcept {
+    TREE_ASSERT_LESS(L);
+    iterator i(this);
+    size_t n = 0;
+    for (TREE* r = root; r != nullptr;) {
+      i.path.push(r);
+      if (!compare(r, t)) {
+        n = i.path.size();
+        r = child(r, 0);
+      } else {
+        r = child(r, 1);
+      }
+    }
+    i.path.truncate(n);
+    while (*i != nullptr && *i != t && !compare(t, *i)) {
+      ++i;
+    }
+    if (*i != t) {
+      i.path.clear();
+    }
+    return i;
+  }
+
+  // in-order successor and predecessor of t, nullptr past either end. O(height) from the root without a path
+  // A node equal to t met on the way falls back to iterator_to
+  template <typename L> TREE* next(TREE* t, L&& compare) const noexcept {
+    TREE_ASSERT_LESS(L);
+    return RIGHT_EMPTY(t) ? climb(t, 1, compare) : min(TREE_RCHILD(t));
+  }
+
+  template <typename L> TREE* prev(TREE* t, L&& compare) const noexcept {
+    TREE_ASSERT_LESS(L);
+    return LEFT_EMPTY(t) ? climb(t, 0, compare) : max(TREE_LCHILD(t));
+  }
+
+  // lower_bound and upper_bound below t
+  template <typename K, typename C> static TREE* lower_bound(TREE* t, const K& key, C&& compare) noexcept {
+    TREE* lo = nullptr;
+    while (t != nullptr) {
+      if (compare(key, t) <= 0) {
+        lo = t;
+        t = child(t, 0);
+      } else {
+        t = child(t, 1);
+      }
+    }
+    return lo;
+  }
+
+  template <typename K, typename C> static TREE* upper_bound(TREE* t, const K& key, C&& compare) noexcept {
+    TREE* hi = nullptr;
+    while (t != nullptr) {
+      if (compare(key, t) < 0) {
+        hi = t;
+        t = child(t, 0);
+      } else {
+        t = child(t, 1);
+      }
+    }
+    return hi;
+  }
+
   template <typename F, typename... Args> void iterate_preorder(F&& f, TREE* last, Args&&... args) const noexcept {
-    f(last, std::forward<Args>(args)...);
-    if (!LEFT_EMPTY(last))
-      iterate_preorder(f, TREE_LEFT(last), std::forward<Args>(args)...);
-    if (!RIGHT_EMPTY(last))
-      iterate_preorder(f, TREE_RIGHT(last), std::forward<Args>(args)...);
+    tree_stack s;
+    for (;;) {
+      if (!tree_visit(f, last, args...)) {
+        return;
+      }
+      if (!LEFT_EMPTY(last)) {
+        if (!RIGHT_EMPTY(last)) {
+          s.push(TREE_RCHILD(last));
+        }
+        last = TREE_LCHILD(last);
+      } else if (!RIGHT_EMPTY(last)) {
+        last = TREE_RCHILD(last);
+      } else if (!s.empty()) {
+        last = s.pop();
+      } else {
+        break;
+      }
+    }
   }
 
   template <typename F, typename... Args> void iterate_inorder(F&& f, TREE* last, Args&&... args) const noexcept {
-    if (!LEFT_EMPTY(last))
-      iterate_inorder(f, TREE_LEFT(last), std::forward<Args>(args)...);
-    f(last, std::forward<Args>(args)...);
-    if (!RIGHT_EMPTY(last))
-      iterate_inorder(f, TREE_RIGHT(last), std::forward<Args>(args)...);
+    tree_stack s;
+    for (;;) {
+      while (!LEFT_EMPTY(last)) {
+        s.push(last);
+        last = TREE_LCHILD(last);
+      }
+      if (!tree_visit(f, last, args...)) {
+        return;
+      }
+      while (RIGHT_EMPTY(last)) {
+        if (s.empty()) {
+          return;
+        }
+        last = s.pop();
+        if (!tree_visit(f, last, args...)) {
+          return;
+        }
+      }
+      last = TREE_RCHILD(last);
+    }
+  }
+
+  // in-order in O(1) memory by threading empty right links (Morris). O(n)
+  // Nothing may read the tree meanwhile, f included
+  template <typename F, typename... Args> void iterate_morris(F&& f, TREE* last, Args&&... args) const noexcept {
+    bool visit = true;
+    size_t threads = 0;
+    while (last != nullptr && (visit || threads > 0)) {
+      if (!LEFT_EMPTY(last)) {
+        TREE* p = TREE_LCHILD(last);
+        while (!RIGHT_EMPTY(p) && TREE_RCHILD(p) != last) {
+          p = TREE_RCHILD(p);
+        }
+        if (RIGHT_EMPTY(p)) {
+          if (visit) { // the left subtree comes first, no thread below it is pending otherwise
+            TREE_SET_RCHILD(p, last);
+            threads++;
+            last = TREE_LCHILD(last);
+            continue;
+          }
+        } else {
+          TREE_SET_RCHILD(p, p);
+          threads--;
+        }
+      }
+      if (visit && !tree_visit(f, last, args...)) {
+        visit = false;
+      }
+      last = RIGHT_EMPTY(last) ? nullptr : TREE_RCHILD(last);
+    }
   }
 
+  // the stack holds the whole path down to the node being visited
   template <typename F, typename... Args> void iterate_postorder(F&& f, TREE* last, Args&&... args) const noexcept {
-    if (!LEFT_EMPTY(last))
-      iterate_postorder(f, TREE_LEFT(last), std::forward<Args>(args)...);
-    if (!RIGHT_EMPTY(last))
-      iterate_postorder(f, TREE_RIGHT(last), std::forward<Args>(args)...);
-    f(last, std::forward<Args>(args)...);
+    tree_stack s;
+    for (;;) {
+      for (;;) { // down to the first node in postorder below last
+        s.push(last);
+        if (!LEFT_EMPTY(last)) {
+          last = TREE_LCHILD(last);
+        } else if (!RIGHT_EMPTY(last)) {
+          last = TREE_RCHILD(last);
+        } else {
+          break;
+        }
+      }
+      for (;;) {
+        TREE* t = s.pop();
+        if (!tree_visit(f, t, args...) || s.empty()) {
+          return;
+        }
+        TREE* p = s.top();
+        if (TREE_LCHILD(p) == t && !RIGHT_EMPTY(p)) {
+          last = TREE_RCHILD(p);
+          break;
+        }
+      }
+    }
   }
 
+  // O(n) breadth first through an inline ring. A level wider than half of it moves the ring to the heap
   template <typename F, typename... Args> void iterate_bfs(F&& f, TREE* last, Args&&... args) const noexcept {
-    std::deque<TREE*> ts;
-    ts.push_back(last);
-    while (!ts.empty()) {
-      TREE* t = ts.front();
-      ts.pop_front();
-      f(t, std::forward<Args>(args)...);
-      if (!LEFT_EMPTY(t))
-        ts.push_back(TREE_LEFT(t));
-      if (!RIGHT_EMPTY(t))
-        ts.push_back(TREE_RIGHT(t));
+    TREE* ring[TREE_BFS_INLINE];
+    bfs(ring, TREE_BFS_INLINE, true, f, last, args...);
+  }
+
+  // breadth first through a caller's ring, never allocates and never writes the tree. O(n) with a ring of size() + 1
+  // From a level wider than half of it on, levels are walked one by one from the root, down to TREE_STACK_INLINE deep
+  // False when deeper levels were left out that way
+  template <typename F, typename... Args>
+  bool iterate_bfs_ring(TREE** ring, size_t capacity, F&& f, TREE* last, Args&&... args) const noexcept {
+    return bfs(ring, capacity, false, f, last, args...);
+  }
+
+  // breadth first from depth on, never allocates. About 2n steps when complete, O(n * height) at worst
+  // Levels TREE_STACK_INLINE deep or more are threaded as in iterate_morris, nothing may read the tree meanwhile
+  template <typename F, typename... Args>
+  void iterate_levels(size_t depth, F&& f, TREE* last, Args&&... args) const noexcept {
+    while (depth < TREE_STACK_INLINE ? level(depth, f, last, args...) : level_morris(depth, f, last, args...)) {
+      depth++;
     }
   }
 
@@ -167,18 +718,441 @@ struct intrusive_bst {
     }
   }
 
-  size_t size() const noexcept {
+  // in-order over [lo, hi), compare as in lower_bound. O(height + k)
+  template <typename K, typename C, typename F, typename... Args>
+  void iterate_range(const K& lo, const K& hi, C&& compare, F&& f, Args&&... args) const noexcept {
+    tree_stack s;
+    TREE* t = root;
+    for (;;) {
+      while (t != nullptr) {
+        if (compare(lo, t) <= 0) {
+          s.push(t);
+          t = child(t, 0);
+        } else {
+          t = child(t, 1);
+        }
+      }
+      if (s.empty()) {
+        return;
+      }
+      t = s.pop();
+      if (compare(hi, t) <= 0 || !tree_visit(f, t, args...)) {
+        return;
+      }
+      t = child(t, 1);
+    }
+  }
+
+  // nodes below t, t included, 0 for nullptr
+  size_t size(TREE* t) const noexcept {
     size_t size = 0;
-    auto count = [&size](TREE* t) { size++; };
-    iterate(TREE_TRAVERSE_INORDER, count);
+    if (t != nullptr) {
+      iterate_preorder([&size](TREE*) { size++; }, t);
+    }
     return size;
   }
 
+  size_t size() const noexcept { return size(root); }
+
+  // O(n), no recursion
   size_t height(TREE* t) const noexcept {
-    size_t l = LEFT_EMPTY(t) ? 0 : height(TREE_LEFT(t));
-    size_t r = RIGHT_EMPTY(t) ? 0 : height(TREE_RIGHT(t));
-    return 1 + (l > r ? l : r);
+    basic_tree_stack<tree_depth> s;
+    size_t h = 0;
+    size_t d = 1;
+    for (;;) {
+      if (!LEFT_EMPTY(t)) {
+        if (!RIGHT_EMPTY(t)) {
+          s.push({TREE_RCHILD(t), d + 1});
+        }
+        t = TREE_LCHILD(t);
+        d++;
+      } else if (!RIGHT_EMPTY(t)) {
+        t = TREE_RCHILD(t);
+        d++;
+      } else {
+        h = d > h ? d : h;
+        if (s.empty()) {
+          return h;
+        }
+        tree_depth p = s.pop();
+        t = p.t;
+        d = p.depth;
+      }
+    }
   }
 
   size_t height() const noexcept { return empty() ? 0ll : height(root); }
+
+  // all levels full but the last. O(n), O(1) memory
+  void rebalance() noexcept { root = balance(root); }
+
+  // replaces the contents with the n sorted nodes node(*first) onwards, as shallow as they go. O(n), no comparisons
+  template <typename I, typename F> void build(I first, size_t n, F&& node) { root = assemble(first, n, node); }
+
+  void build(TREE** ts, size_t n) {
+    build(ts, n, [](TREE* t) { return t; });
+  }
+
+protected:
+  // moves t down towards dir, returns the child taking its place. A refreshes both
+  template <typename A> static TREE* rotate(TREE* t, int dir) noexcept {
+    TREE* c = child(t, !dir);
+    link(t, !dir, child(c, dir));
+    link(c, dir, t);
+    A::update(t);
+    A::update(c);
+    return c;
+  }
+
+  // one step of a search for t, the side to go on or -1 when p is equal. A less keeps in e the last node not after t
+  // for found to check at the bottom
+  template <typename L> static int probe(L& compare, TREE* t, TREE* p, TREE*& e) {
+    if (tree_three_way<L>::value) {
+      int o = int(compare(t, p));
+      return o == 0 ? -1 : o > 0;
+    }
+    if (compare(t, p)) {
+      return 0;
+    }
+    e = p;
+    return 1;
+  }
+
+  template <typename L> static bool found(L& compare, TREE* t, TREE* e) {
+    return !tree_three_way<L>::value && e != nullptr && !compare(e, t);
+  }
+
+  // turns i.path into the path to where t goes before *i, returns the side t hangs on under its top
+  template <typename L> int locate(iterator& i, TREE* t, L& compare) const {
+    TREE_ASSERT_LESS(L);
+    tree_stack& path = i.path;
+    if (empty()) {
+      path.clear();
+      return 0;
+    }
+    TREE* h = *i;
+    if (h == nullptr) { // past the last node
+      i.descend(root, 1);
+      if (!compare(t, path.top())) {
+        return 1;
+      }
+    } else if (!compare(h, t)) {
+      if (LEFT_EMPTY(h)) { // the predecessor is the nearest ancestor h hangs right of
+        size_t j = path.size() - 1;
+        while (j > 0 && child(path.base[j - 1], 1) != path.base[j]) {
+          j--;
+        }
+        if (j == 0 || !compare(t, path.base[j - 1])) {
+          return 0;
+        }
+      } else {
+        i.descend(TREE_LCHILD(h), 1);
+        if (!compare(t, path.top())) {
+          return 1;
+        }
+      }
+    }
+
+    // climb until both bounds of the subtree admit t
+    size_t k = path.size();
+    bool lo = false;
+    bool hi = false;
+    for (size_t j = k - 1; j > 0 && !(lo && hi); j--) {
+      TREE* a = path.base[j - 1];
+      bool right = child(a, 1) == path.base[j];
+      if (right ? lo : hi) {
+        continue;
+      }
+      if (right ? compare(t, a) : compare(a, t)) {
+        k = j;
+        lo = hi = false;
+      } else if (right) {
+        lo = true;
+      } else {
+        hi = true;
+      }
+    }
+    path.truncate(k);
+    for (TREE* p = path.top();;) {
+      int dir = !compare(t, p);
+      p = child(p, dir);
+      if (p == nullptr) {
+        return dir;
+      }
+      path.push(p);
+    }
+  }
+
+private:
+  // the nearest ancestor t hangs below on the side away from dir, found from the root
+  template <typename L> TREE* climb(TREE* t, int dir, L& compare) const noexcept {
+    TREE* a = nullptr;
+    for (TREE* r = root; r != t;) {
+      int d = compare(r, t) ? 1 : (compare(t, r) ? 0 : -1);
+      if (d < 0) {
+        iterator i = iterator_to(t, compare);
+        return *(dir ? ++i : --i);
+      }
+      if (d != dir) {
+        a = r;
+      }
+      r = child(r, d);
+    }
+    return a;
+  }
+
+  // recursion log2(n) deep
+  template <typename I, typename F> static TREE* assemble(I& it, size_t n, F& node) {
+    if (n == 0) {
+      return nullptr;
+    }
+    TREE* l = assemble(it, n / 2, node);
+    TREE* t = node(*it);
+    ++it;
+    TREE_INIT(t);
+    link(t, 0, l);
+    link(t, 1, assemble(it, n - n / 2 - 1, node));
+    return t;
+  }
+
+  // count left rotations down the vine right of head
+  static void compress(TREE* head, size_t count) noexcept {
+    for (TREE* scanner = head; count > 0; count--) {
+      TREE* c = child(scanner, 1);
+      TREE* g = child(c, 1);
+      link(scanner, 1, g);
+      link(c, 1, child(g, 0));
+      link(g, 0, c);
+      scanner = g;
+    }
+  }
+
+  // preorder cut at depth, at most depth + 1 entries on the stack. False once f stops or the next level is empty
+  template <typename F, typename... Args> bool level(size_t depth, F& f, TREE* last, Args&... args) const noexcept {
+    basic_tree_stack<tree_depth> s;
+    bool more = false;
+    s.push({last, 0});
+    while (!s.empty()) {
+      tree_depth p = s.pop();
+      if (p.depth == depth) {
+        more = more || !TREE_EMPTY(p.t);
+        if (!tree_visit(f, p.t, args...)) {
+          return false;
+        }
+        continue;
+      }
+      if (!RIGHT_EMPTY(p.t)) {
+        s.push({TREE_RCHILD(p.t), p.depth + 1});
+      }
+      if (!LEFT_EMPTY(p.t)) {
+        s.push({TREE_LCHILD(p.t), p.depth + 1});
+      }
+    }
+    return more;
+  }
+
+  // as level, threaded as in iterate_morris. A thread back from k links right of the left child takes d down k + 2
+  template <typename F, typename... Args>
+  bool level_morris(size_t depth, F& f, TREE* last, Args&... args) const noexcept {
+    bool visit = true;
+    bool found = false;
+    size_t threads = 0;
+    size_t d = 0;
+    while (last != nullptr && (visit || threads > 0)) {
+      if (!LEFT_EMPTY(last)) {
+        TREE* p = TREE_LCHILD(last);
+        size_t k = 0;
+        while (!RIGHT_EMPTY(p) && TREE_RCHILD(p) != last) {
+          p = TREE_RCHILD(p);
+          k++;
+        }
+        if (RIGHT_EMPTY(p)) {
+          if (visit) {
+            TREE_SET_RCHILD(p, last);
+            threads++;
+            last = TREE_LCHILD(last);
+            d++;
+            continue;
+          }
+        } else {
+          TREE_SET_RCHILD(p, p);
+          threads--;
+          d -= k + 2;
+        }
+      }
+      if (visit && d == depth) {
+        found = true;
+        visit = tree_visit(f, last, args...);
+      }
+      last = RIGHT_EMPTY(last) ? nullptr : TREE_RCHILD(last);
+      d++;
+    }
+    return visit && found;
+  }
+
+  template <typename F, typename... Args>
+  bool bfs(TREE** ring, size_t capacity, bool grow, F& f, TREE* last, Args&... args) const noexcept {
+    TREE** heap = nullptr;
+    size_t head = 0;
+    size_t count = 1;
+    size_t depth = 0;
+    ring[0] = last;
+    while (count > 0) {
+      if (2 * count > capacity) {
+        if (!grow) {
+          while (depth < TREE_STACK_INLINE && level(depth, f, last, args...)) {
+            depth++;
+          }
+          return depth < TREE_STACK_INLINE;
+        }
+        size_t c = 4 * count;
+        TREE** r = (TREE**)TREE_MALLOC(c * sizeof(TREE*));
+        assert(r != nullptr);
+        for (size_t i = 0; i < count; i++) {
+          r[i] = ring[(head + i) % capacity];
+        }
+        TREE_FREE(heap);
+        heap = ring = r;
+        capacity = c;
+        head = 0;
+      }
+      for (size_t level = count; level > 0; level--) {
+        TREE* t = ring[head];
+        head = head + 1 == capacity ? 0 : head + 1;
+        count--;
+        if (!tree_visit(f, t, args...)) {
+          count = 0;
+          break;
+        }
+        if (!LEFT_EMPTY(t)) {
+          ring[(head + count++) % capacity] = TREE_LCHILD(t);
+        }
+        if (!RIGHT_EMPTY(t)) {
+          ring[(head + count++) % capacity] = TREE_RCHILD(t);
+        }
+      }
+      depth++;
+    }
+    TREE_FREE(heap);
+    return true;
+  }
+};
+
+// a descent kept for the variants that fix the tree up on the way back, pa[j] was left on side da[j]
+// pa[0] is head, its left link stands for the root slot so the root changes like any other link
+template <size_t N> struct tree_path {
+  TREE head;
+  TREE* pa[N];
+  int da[N];
+  int k; // pa[1, k) are nodes of the tree
+
+  explicit tree_path(TREE* root) noexcept : k(1) {
+    TREE_INIT(&head);
+    intrusive_bst::link(&head, 0, root);
+    pa[0] = &head;
+    da[0] = 0;
+  }
+  tree_path(const tree_path&) = delete;
+  tree_path& operator=(const tree_path&) = delete;
+
+  TREE* root() noexcept { return intrusive_bst::child(&head, 0); }
+
+  void push(TREE* p, int dir) noexcept {
+    pa[k] = p;
+    da[k++] = dir;
+  }
+
+  // down to where t goes, after any node equal to it
+  template <typename L> void descend(TREE* t, L& compare) {
+    for (TREE* p = root(); p != nullptr;) {
+      int dir = !compare(t, p);
+      push(p, dir);
+      p = intrusive_bst::child(p, dir);
+    }
+  }
+
+  // down to one node equal to t, returns it or nullptr
+  template <typename L> TREE* find(TREE* t, L& compare) {
+    TREE* p = root();
+    while (p != nullptr) {
+      int o = tree_order(compare, t, p);
+      if (o == 0) {
+        break;
+      }
+      push(p, o > 0);
+      p = intrusive_bst::child(p, o > 0);
+    }
+    return p;
+  }
+
+  // unlinks p, the child of pa[k - 1] on side da[k - 1]. Returns its successor, which takes its place, or nullptr
+  // when p has no right child. The path then ends above the link that lost a node
+  TREE* splice(TREE* p) noexcept {
+    TREE* r = intrusive_bst::child(p, 1);
+    if (r == nullptr) {
+      intrusive_bst::link(pa[k - 1], da[k - 1], intrusive_bst::child(p, 0));
+      return nullptr;
+    }
+    if (intrusive_bst::child(r, 0) == nullptr) {
+      intrusive_bst::link(r, 0, intrusive_bst::child(p, 0));
+      intrusive_bst::link(pa[k - 1], da[k - 1], r);
+      push(r, 1);
+      return r;
+    }
+    TREE* s = nullptr;
+    int j = k++;
+    for (;;) {
+      push(r, 0);
+      s = intrusive_bst::child(r, 0);
+      if (intrusive_bst::child(s, 0) == nullptr) {
+        break;
+      }
+      r = s;
+    }
+    pa[j] = s;
+    da[j] = 1;
+    intrusive_bst::link(pa[j - 1], da[j - 1], s);
+    intrusive_bst::link(s, 0, intrusive_bst::child(p, 0));
+    intrusive_bst::link(r, 0, intrusive_bst::child(s, 1));
+    intrusive_bst::link(s, 1, intrusive_bst::child(p, 1));
+    return s;
+  }
+
+  // refreshes pa[1, k) bottom up
+  template <typename A> void update() const noexcept {
+    for (int j = k; --j > 0;) {
+      A::update(pa[j]);
+    }
+  }
+};
+
+// intrusive_bst with only its read api public, the balanced variants derive from it
+struct intrusive_bst_base : protected intrusive_bst {
+  using intrusive_bst::begin;
+  using intrusive_bst::child;
+  using intrusive_bst::clear;
+  using intrusive_bst::empty;
+  using intrusive_bst::end;
+  using intrusive_bst::equal_range;
+  using intrusive_bst::find;
+  using intrusive_bst::height;
+  using intrusive_bst::iterate;
+  using intrusive_bst::iterate_bfs;
+  using intrusive_bst::iterate_bfs_ring;
+  using intrusive_bst::iterate_inorder;
+  using intrusive_bst::iterate_levels;
+  using intrusive_bst::iterate_morris;
+  using intrusive_bst::iterate_postorder;
+  using intrusive_bst::iterate_preorder;
+  using intrusive_bst::iterate_range;
+  using intrusive_bst::iterator;
+  using intrusive_bst::iterator_to;
+  using intrusive_bst::lower_bound;
+  using intrusive_bst::max;
+  using intrusive_bst::min;
+  using intrusive_bst::next;
+  using intrusive_bst::prev;
+  using intrusive_bst::root;
+  using intrusive_bst::size;
+  using intrusive_bst::upper_bound;
 };
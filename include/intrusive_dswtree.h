@@ -0,0 +1,82 @@
+#pragma once
+#include <math.h>
+
+#include "intrusive_bst.h"
+
+// intrusive_bst rebuilt in place once an insert lands deeper than factor * log2(n). Factor 0 never rebuilds
+struct intrusive_dswtree : intrusive_bst_base {
+  size_t count = 0;
+  double factor; // below 1 it would rebuild on every insert
+
+  explicit intrusive_dswtree(double f = 2.0) : factor(f) {}
+
+  void clear() noexcept {
+    root = nullptr;
+    count = 0;
+  }
+
+  // O(1)
+  size_t size() const noexcept { return count; }
+
+  // O(n)
+  void rebalance() noexcept { root = balance(root); }
+
+  // amortized O(log n) for factor above 1
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    TREE_INIT(t);
+    count++;
+    if (empty()) {
+      root = t;
+      return;
+    }
+    size_t depth = 1; // of r
+    for (TREE* r = root;; depth++) {
+      int dir = !compare(t, r);
+      TREE* c = child(r, dir);
+      if (c == nullptr) {
+        link(r, dir, t);
+        break;
+      }
+      r = c;
+    }
+    if (factor > 0 && double(depth + 1) > factor * log2(double(count))) {
+      rebuild(t, compare);
+    }
+  }
+
+  // O(height). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    TREE* p = intrusive_bst::erase(t, compare);
+    if (p != nullptr) {
+      count--;
+    }
+    return p;
+  }
+
+private:
+  // descend again keeping the path, count sizes on the way up
+  template <typename L> void rebuild(TREE* t, L&& compare) {
+    tree_stack path;
+    for (TREE* r = root; r != t; r = child(r, !compare(t, r))) {
+      path.push(r);
+    }
+    size_t n = 1; // nodes below a, a included
+    size_t h = 1; // from a down to t, both included
+    for (TREE* below = t; !path.empty(); below = path.pop()) {
+      TREE* a = path.top();
+      n += 1 + intrusive_bst::size(child(a, child(a, 0) == below));
+      h++;
+      if (double(h) > factor * log2(double(n))) {
+        path.pop();
+        TREE* b = balance(a);
+        if (path.empty()) {
+          root = b;
+        } else {
+          link(path.top(), child(path.top(), 1) == a, b);
+        }
+        return;
+      }
+    }
+  }
+};
@@ -0,0 +1,100 @@
+#pragma once
+#include <functional>
+
+#include "intrusive_bst.h"
+
+// the key array starts on a line and a search asks for the line of keys a few levels ahead of it
+#define FROZEN_TREE_LINE 64
+
+// read only snapshot of a tree, keys in Eytzinger order. Searches are branchless and prefetch ahead.
+// later changes to the tree are not seen
+template <typename K, typename Compare = std::less<K>> struct frozen_tree {
+  static_assert(std::is_trivially_copyable<K>::value, "K is kept in raw memory");
+
+  Compare compare;
+
+  frozen_tree() : compare(), n(0), mem(nullptr), keys(nullptr), nodes(&none), none(nullptr) {}
+  explicit frozen_tree(const Compare& c) : compare(c), n(0), mem(nullptr), keys(nullptr), nodes(&none), none(nullptr) {}
+  frozen_tree(const frozen_tree&) = delete;
+  frozen_tree& operator=(const frozen_tree&) = delete;
+  ~frozen_tree() { release(); }
+
+  bool empty() const noexcept { return n == 0; }
+  size_t size() const noexcept { return n; }
+
+  // O(n). Snapshots tree, key(t) gives the K of t
+  template <typename Tree, typename F> void freeze(const Tree& tree, F&& key) {
+    release();
+    n = tree.size();
+    mem = malloc((n + 1) * sizeof(K) + FROZEN_TREE_LINE);
+    nodes = (TREE**)malloc((n + 1) * sizeof(TREE*));
+    assert(mem != nullptr && nodes != nullptr);
+    keys = (K*)(((uintptr_t)mem + FROZEN_TREE_LINE - 1) & ~(uintptr_t)(FROZEN_TREE_LINE - 1));
+    nodes[0] = nullptr; // what a search past the last key ends on
+
+    // slots in in-order of the implicit tree, the leftmost first
+    size_t i = 1;
+    while (2 * i <= n) {
+      i *= 2;
+    }
+    tree.iterate(TREE_TRAVERSE_INORDER, [&](TREE* t) {
+      K k = key(t);
+      memcpy((void*)&keys[i], (const void*)&k, sizeof(K));
+      nodes[i] = t;
+      if (2 * i + 1 <= n) { // down the right once then left all the way
+        i = 2 * i + 1;
+        while (2 * i <= n) {
+          i *= 2;
+        }
+      } else { // up past every right child, then once more
+        while (i & 1) {
+          i >>= 1;
+        }
+        i >>= 1;
+      }
+    });
+  }
+
+  // first node whose key is not ordered before key, nullptr if there is none, O(log n)
+  TREE* lower_bound(const K& key) const noexcept { return nodes[search<0>(key)]; }
+
+  // first node whose key is ordered after key
+  TREE* upper_bound(const K& key) const noexcept { return nodes[search<1>(key)]; }
+
+  // the first node with key, as lower_bound is
+  TREE* find(const K& key) const noexcept {
+    size_t i = search<0>(key);
+    return i != 0 && !compare(key, keys[i]) ? nodes[i] : nullptr;
+  }
+
+private:
+  // keys to a line, a power of two 2^d, so the 2^d descendants d levels below slot i share the line at slot i * 2^d
+  static constexpr size_t stride(size_t s = FROZEN_TREE_LINE / sizeof(K)) { return s <= 1 ? 1 : 2 * stride(s / 2); }
+
+  // slot of the lower or upper bound, 0 for none. The last left turn, past the trailing ones of i
+  template <int upper> size_t search(const K& key) const noexcept {
+    size_t i = 1;
+    while (i <= n) {
+      __builtin_prefetch((const void*)((uintptr_t)keys + i * stride() * sizeof(K)));
+      i = 2 * i + (upper ? !compare(key, keys[i]) : compare(keys[i], key));
+    }
+    return i >> (__builtin_ctzll(~(unsigned long long)i) + 1);
+  }
+
+  void release() noexcept {
+    free(mem);
+    if (nodes != &none) {
+      free(nodes);
+    }
+    n = 0;
+    mem = nullptr;
+    keys = nullptr;
+    nodes = &none;
+  }
+
+  size_t n;
+  void* mem;
+  K* keys; // keys[1, n] in mem, on a line boundary
+  TREE** nodes;
+  TREE* none; // nodes[0] while nothing is frozen, so a search of no keys ends on nullptr too
+};
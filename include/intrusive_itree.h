@@ -0,0 +1,84 @@
+#pragma once
+#include "intrusive_rbtree.h"
+
+// a TREE followed by the interval [lo, hi) it stands for and the largest hi below it, itself included
+typedef void* ITREE[2 + 3 * sizeof(uint64_t) / sizeof(void*)];
+#define ITREE_NODE(i) ((TREE*)(i))
+#define ITREE_ENDS(t) ((uint64_t*)((void**)(t) + 2))
+#define ITREE_LOW(t) (ITREE_ENDS(t)[0])
+#define ITREE_HIGH(t) (ITREE_ENDS(t)[1])
+#define ITREE_MAX(t) (ITREE_ENDS(t)[2])
+
+#define ITREE_INIT(i, lo, hi)                                                                                          \
+  do {                                                                                                                 \
+    TREE_INIT(ITREE_NODE(i));                                                                                          \
+    ITREE_LOW(ITREE_NODE(i)) = (lo);                                                                                   \
+    ITREE_HIGH(ITREE_NODE(i)) = (hi);                                                                                  \
+    ITREE_MAX(ITREE_NODE(i)) = (hi);                                                                                   \
+  } while (0)
+
+struct itree_augment {
+  static uint64_t max(TREE* t) noexcept { return t == nullptr ? 0 : ITREE_MAX(t); }
+  static void update(TREE* t) noexcept {
+    uint64_t m = ITREE_HIGH(t);
+    uint64_t l = max(intrusive_bst::child(t, 0));
+    uint64_t r = max(intrusive_bst::child(t, 1));
+    ITREE_MAX(t) = m > l ? (m > r ? m : r) : (l > r ? l : r);
+  }
+};
+
+// interval red-black tree over ITREE nodes, ordered by lo, hi, then address. Intervals are non empty
+struct intrusive_itree : basic_rbtree<itree_augment> {
+  // O(log n)
+  void insert(TREE* t) {
+    assert(ITREE_LOW(t) < ITREE_HIGH(t));
+    basic_rbtree<itree_augment>::insert(t, [](TREE* t1, TREE* t2) { return order(t1, t2) < 0; });
+  }
+
+  // O(log n). Removes t itself, returns it or nullptr
+  TREE* erase(TREE* t) { return basic_rbtree<itree_augment>::erase(t, tree_compare(order)); }
+
+  // O(log n). One node overlapping [a, b) or nullptr
+  TREE* find_overlap(uint64_t a, uint64_t b) const noexcept {
+    TREE* t = a < b ? root : nullptr;
+    while (t != nullptr && !(ITREE_LOW(t) < b && a < ITREE_HIGH(t))) {
+      TREE* l = child(t, 0);
+      t = itree_augment::max(l) > a ? l : child(t, 1);
+    }
+    return t;
+  }
+
+  // O((k + 1) log n) for k hits. In order over the nodes overlapping [a, b)
+  template <typename F, typename... Args>
+  void iterate_overlaps(uint64_t a, uint64_t b, F&& f, Args&&... args) const noexcept {
+    tree_stack s;
+    TREE* t = a < b ? root : nullptr;
+    for (;;) {
+      while (t != nullptr && ITREE_MAX(t) > a) {
+        s.push(t);
+        t = child(t, 0);
+      }
+      if (s.empty()) {
+        return;
+      }
+      t = s.pop();
+      if (ITREE_LOW(t) >= b) {
+        return;
+      }
+      if (a < ITREE_HIGH(t) && !tree_visit(f, t, args...)) {
+        return;
+      }
+      t = child(t, 1);
+    }
+  }
+
+  static int order(TREE* t1, TREE* t2) noexcept {
+    if (ITREE_LOW(t1) != ITREE_LOW(t2)) {
+      return ITREE_LOW(t1) < ITREE_LOW(t2) ? -1 : 1;
+    }
+    if (ITREE_HIGH(t1) != ITREE_HIGH(t2)) {
+      return ITREE_HIGH(t1) < ITREE_HIGH(t2) ? -1 : 1;
+    }
+    return t1 < t2 ? -1 : (t1 > t2 ? 1 : 0);
+  }
+};
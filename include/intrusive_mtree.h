@@ -0,0 +1,66 @@
+#pragma once
+#include "intrusive_rbtree.h"
+
+// M::combine must be associative with M::identity() as its unit
+//   typedef ... type;
+//   static type identity();
+//   static type combine(const type& l, const type& r);
+//   static type value(TREE* t);   t alone
+//   static type& sum(TREE* t);    the subtree under t
+template <typename M> struct monoid_augment {
+  typedef typename M::type type;
+
+  static type sum(TREE* t) { return t == nullptr ? M::identity() : M::sum(t); }
+  static void update(TREE* t) {
+    M::sum(t) = M::combine(M::combine(sum(intrusive_bst::child(t, 0)), M::value(t)), sum(intrusive_bst::child(t, 1)));
+  }
+};
+
+// red-black tree summarizing any key range in O(log n)
+template <typename M> struct intrusive_mtree : basic_rbtree<monoid_augment<M>> {
+  typedef monoid_augment<M> augment;
+  typedef typename M::type type;
+
+  using basic_rbtree<augment>::child;
+  using basic_rbtree<augment>::root;
+
+  // every node, O(1)
+  type aggregate() const { return augment::sum(root); }
+
+  // O(log n). The nodes in [lo, hi), compare as in lower_bound
+  template <typename K, typename C> type aggregate(const K& lo, const K& hi, C&& compare) const {
+    TREE* t = root;
+    while (t != nullptr) {
+      if (compare(hi, t) <= 0) {
+        t = child(t, 0);
+      } else if (compare(lo, t) > 0) {
+        t = child(t, 1);
+      } else {
+        break;
+      }
+    }
+    if (t == nullptr) {
+      return M::identity();
+    }
+
+    type l = M::identity(); // what is in range below t on the left, gathered right to left
+    for (TREE* p = child(t, 0); p != nullptr;) {
+      if (compare(lo, p) <= 0) {
+        l = M::combine(M::combine(M::value(p), augment::sum(child(p, 1))), l);
+        p = child(p, 0);
+      } else {
+        p = child(p, 1);
+      }
+    }
+    type r = M::identity(); // and on the right, gathered left to right
+    for (TREE* p = child(t, 1); p != nullptr;) {
+      if (compare(hi, p) > 0) {
+        r = M::combine(r, M::combine(augment::sum(child(p, 0)), M::value(p)));
+        p = child(p, 1);
+      } else {
+        p = child(p, 0);
+      }
+    }
+    return M::combine(M::combine(l, M::value(t)), r);
+  }
+};
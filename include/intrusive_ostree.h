@@ -0,0 +1,59 @@
+#pragma once
+#include "intrusive_rbtree.h"
+
+// a TREE followed by the number of nodes below it, itself included
+typedef void* OSTREE[3];
+#define OSTREE_NODE(o) ((TREE*)(o))
+#define OSTREE_SIZE(t) (*(size_t*)&(((void**)(t))[2]))
+
+#define OSTREE_INIT(o)                                                                                                 \
+  do {                                                                                                                 \
+    TREE_INIT(OSTREE_NODE(o));                                                                                         \
+    OSTREE_SIZE(OSTREE_NODE(o)) = 1;                                                                                   \
+  } while (0)
+
+struct ostree_augment {
+  static size_t size(TREE* t) noexcept { return t == nullptr ? 0 : OSTREE_SIZE(t); }
+  static void update(TREE* t) noexcept {
+    OSTREE_SIZE(t) = 1 + size(intrusive_bst::child(t, 0)) + size(intrusive_bst::child(t, 1));
+  }
+};
+
+// order statistic red-black tree, every node is an OSTREE passed around as TREE* through OSTREE_NODE
+struct intrusive_ostree : basic_rbtree<ostree_augment> {
+  // O(1)
+  size_t size() const noexcept { return ostree_augment::size(root); }
+
+  // O(log n). Number of nodes before key, compare as in lower_bound
+  template <typename K, typename C> size_t rank(const K& key, C&& compare) const noexcept {
+    size_t r = 0;
+    TREE* t = root;
+    while (t != nullptr) {
+      if (compare(key, t) <= 0) {
+        t = child(t, 0);
+      } else {
+        r += 1 + ostree_augment::size(child(t, 0));
+        t = child(t, 1);
+      }
+    }
+    return r;
+  }
+
+  // O(log n). The node of rank i, nullptr past the end
+  TREE* select(size_t i) const noexcept {
+    TREE* t = root;
+    while (t != nullptr) {
+      size_t l = ostree_augment::size(child(t, 0));
+      if (i == l) {
+        break;
+      }
+      if (i < l) {
+        t = child(t, 0);
+      } else {
+        i -= l + 1;
+        t = child(t, 1);
+      }
+    }
+    return t;
+  }
+};
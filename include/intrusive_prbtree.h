@@ -0,0 +1,197 @@
+#pragma once
+#include "intrusive_rbtree.h"
+
+// a TREE followed by its parent, nullptr at the root
+typedef void* PTREE[3];
+#define PTREE_NODE(p) ((TREE*)(p))
+#define PTREE_PARENT(t) (*(TREE**)&(((void**)(t))[2]))
+
+#define PTREE_INIT(p)                                                                                                  \
+  do {                                                                                                                 \
+    TREE_INIT(PTREE_NODE(p));                                                                                          \
+    PTREE_PARENT(PTREE_NODE(p)) = nullptr;                                                                             \
+  } while (0)
+
+// red-black tree over PTREE nodes passed around as TREE* through PTREE_NODE.
+// erase and next/prev work from the node itself, without a comparison
+struct intrusive_prbtree : intrusive_bst_base {
+  using intrusive_bst::next;
+  using intrusive_bst::prev;
+
+  // O(log n), t after any node equal to it
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    TREE* p = nullptr;
+    int dir = 0;
+    for (TREE* r = root; r != nullptr; r = child(r, dir)) {
+      p = r;
+      dir = !compare(t, r);
+    }
+    TREE_INIT(t);
+    RBTREE_SET_RED(t);
+    PTREE_PARENT(t) = p;
+    if (p != nullptr) {
+      link(p, dir, t);
+    } else {
+      root = t;
+    }
+
+    while ((p = PTREE_PARENT(t)) != nullptr && RBTREE_RED(p)) {
+      TREE* g = PTREE_PARENT(p); // there since the root is black
+      int d = child(g, 1) == p;
+      TREE* y = child(g, !d);
+      if (y != nullptr && RBTREE_RED(y)) {
+        RBTREE_SET_BLACK(p);
+        RBTREE_SET_BLACK(y);
+        RBTREE_SET_RED(g);
+        t = g;
+        continue;
+      }
+      if (child(p, !d) == t) { // inner grandchild, brought up first
+        rotate(p, d);
+        p = t;
+      }
+      rotate(g, !d);
+      RBTREE_SET_BLACK(p);
+      RBTREE_SET_RED(g);
+      break;
+    }
+    RBTREE_SET_BLACK(root);
+  }
+
+  // O(log n), no comparison. Removes t itself and returns it
+  TREE* erase(TREE* t) noexcept {
+    TREE* l = child(t, 0);
+    TREE* r = child(t, 1);
+    TREE* x = nullptr; // what takes the place of the node going away, with its parent xp
+    TREE* xp = nullptr;
+    bool red = false; // color of the position going away
+    if (l == nullptr || r == nullptr) {
+      x = l != nullptr ? l : r;
+      xp = PTREE_PARENT(t);
+      red = RBTREE_RED(t);
+      replace(xp, t, x);
+    } else { // the successor s takes the place and color of t
+      TREE* s = intrusive_bst::min(r);
+      red = RBTREE_RED(s);
+      x = child(s, 1);
+      if (PTREE_PARENT(s) == t) {
+        xp = s;
+      } else {
+        xp = PTREE_PARENT(s);
+        link(xp, 0, x);
+        link(s, 1, r);
+      }
+      link(s, 0, l);
+      replace(PTREE_PARENT(t), t, s);
+      set_color(s, RBTREE_RED(t));
+    }
+
+    while (!red && x != root && (x == nullptr || !RBTREE_RED(x))) { // x is a black short
+      int d = child(xp, 0) != x;
+      TREE* w = child(xp, !d); // there since x is short
+      if (RBTREE_RED(w)) {
+        RBTREE_SET_BLACK(w);
+        RBTREE_SET_RED(xp);
+        rotate(xp, d);
+        w = child(xp, !d);
+      }
+      TREE* near = child(w, d);
+      TREE* far = child(w, !d);
+      if ((near == nullptr || !RBTREE_RED(near)) && (far == nullptr || !RBTREE_RED(far))) {
+        RBTREE_SET_RED(w);
+        x = xp;
+        xp = PTREE_PARENT(x);
+        continue;
+      }
+      if (far == nullptr || !RBTREE_RED(far)) {
+        RBTREE_SET_BLACK(near);
+        RBTREE_SET_RED(w);
+        rotate(w, !d);
+        w = near;
+      }
+      set_color(w, RBTREE_RED(xp));
+      RBTREE_SET_BLACK(xp);
+      RBTREE_SET_BLACK(child(w, !d));
+      rotate(xp, d);
+      x = root;
+      break;
+    }
+    if (x != nullptr) {
+      RBTREE_SET_BLACK(x);
+    }
+    TREE_INIT(t);
+    PTREE_PARENT(t) = nullptr;
+    return t;
+  }
+
+  // O(log n). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    TREE* p = root;
+    while (p != nullptr) {
+      int o = tree_order(compare, t, p);
+      if (o == 0) {
+        return erase(p);
+      }
+      p = child(p, o > 0);
+    }
+    return nullptr;
+  }
+
+  // amortized O(1). Neighbours of t through the parent links, nullptr past either end
+  static TREE* next(TREE* t) noexcept { return step(t, 1); }
+  static TREE* prev(TREE* t) noexcept { return step(t, 0); }
+
+private:
+  static TREE* step(TREE* t, int dir) noexcept {
+    TREE* c = child(t, dir);
+    if (c != nullptr) {
+      for (TREE* d = c; d != nullptr; d = child(d, !dir)) {
+        c = d;
+      }
+      return c;
+    }
+    TREE* p = PTREE_PARENT(t);
+    while (p != nullptr && child(p, dir) == t) {
+      t = p;
+      p = PTREE_PARENT(t);
+    }
+    return p;
+  }
+
+  // tag preserving as intrusive_bst::link, c gets t for its parent
+  static void link(TREE* t, int dir, TREE* c) noexcept {
+    intrusive_bst::link(t, dir, c);
+    if (c != nullptr) {
+      PTREE_PARENT(c) = t;
+    }
+  }
+
+  // c takes the place of t below p, the root when p is nullptr
+  void replace(TREE* p, TREE* t, TREE* c) noexcept {
+    if (p == nullptr) {
+      root = c;
+      if (c != nullptr) {
+        PTREE_PARENT(c) = nullptr;
+      }
+    } else {
+      link(p, child(p, 0) != t, c);
+    }
+  }
+
+  static void set_color(TREE* t, bool red) noexcept {
+    if (red) {
+      RBTREE_SET_RED(t);
+    } else {
+      RBTREE_SET_BLACK(t);
+    }
+  }
+
+  // moves t down towards dir, its child on the other side takes its place
+  void rotate(TREE* t, int dir) noexcept {
+    TREE* c = child(t, !dir);
+    link(t, !dir, child(c, dir));
+    replace(PTREE_PARENT(t), t, c);
+    link(c, dir, t);
+  }
+};
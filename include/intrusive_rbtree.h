@@ -0,0 +1,254 @@
+#pragma once
+#include "intrusive_bst.h"
+
+// red lives in the tag bit of the left link, so TREE_INIT leaves a node black
+#define RBTREE_RED(t) (TREE_TAG(TREE_LEFT(t)) != 0)
+#define RBTREE_SET_RED(t) (TREE_LEFT(t) = (TREE*)((uintptr_t)TREE_LEFT(t) | TREE_TAG_MASK))
+#define RBTREE_SET_BLACK(t) (TREE_LEFT(t) = TREE_LCHILD(t))
+
+// height never exceeds 2 * log2(n + 1), one more slot for the head
+#define RBTREE_MAX_HEIGHT 128
+
+// red-black tree over bare TREE nodes, A keeps a summary per node
+template <typename A> struct basic_rbtree : intrusive_bst_base {
+  // O(log n)
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    tree_path<RBTREE_MAX_HEIGHT> path(root);
+    path.descend(t, compare);
+    attach(t, path);
+  }
+
+  // O(log n). Links t unless an equal node is in, returns t or that node
+  template <typename L> TREE* insert_unique(TREE* t, L&& compare) {
+    tree_path<RBTREE_MAX_HEIGHT> path(root);
+    TREE* e = nullptr;
+    for (TREE* p = root; p != nullptr;) {
+      int dir = probe(compare, t, p, e);
+      if (dir < 0) {
+        return p;
+      }
+      path.push(p, dir);
+      p = child(p, dir);
+    }
+    if (found(compare, t, e)) {
+      return e;
+    }
+    attach(t, path);
+    return t;
+  }
+
+  // as intrusive_bst::insert_hint, but hint is left at end(). O(log n), a couple of comparisons for a right hint
+  template <typename L> void insert_hint(iterator& hint, TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    tree_path<RBTREE_MAX_HEIGHT> path(root);
+    if (*hint == nullptr) { // down the right spine straight into the path, t most likely goes last
+      for (TREE* p = root; p != nullptr; p = child(p, 1)) {
+        path.push(p, 1);
+      }
+      if (path.k == 1 || !compare(t, path.pa[path.k - 1])) {
+        attach(t, path);
+        return;
+      }
+      path.k = 1;
+    }
+    int dir = locate(hint, t, compare);
+    tree_stack& s = hint.path;
+    for (size_t j = 0; j < s.size(); j++) {
+      path.push(s.base[j], j + 1 < s.size() ? child(s.base[j], 1) == s.base[j + 1] : dir);
+    }
+    s.clear();
+    attach(t, path);
+  }
+
+  template <typename L> void insert_hint(iterator&& hint, TREE* t, L&& compare) { insert_hint(hint, t, compare); }
+
+  // as intrusive_bst::insert_max. Amortized O(1), O(log n) with an A to refresh
+  void insert_max(iterator& last, TREE* t) noexcept {
+    tree_stack& path = last.path;
+    TREE_INIT(t);
+    if (empty()) {
+      A::update(t);
+      root = t;
+      path.clear();
+      path.push(t);
+      return;
+    }
+    if (path.empty()) {
+      last.descend(root, 1);
+    }
+    assert(RIGHT_EMPTY(path.top()));
+    RBTREE_SET_RED(t);
+    A::update(t);
+    link(path.top(), 1, t);
+    path.push(t);
+    if (!std::is_same<A, tree_no_augment>::value) {
+      for (size_t j = path.size() - 1; j-- > 0;) {
+        A::update(path.base[j]);
+      }
+    }
+
+    // as in attach with every step to the right, so the uncle is always on the left
+    TREE** pa = path.base;
+    size_t k = path.size() - 1;
+    while (k >= 2 && RBTREE_RED(pa[k - 1])) {
+      TREE* g = pa[k - 2];
+      TREE* y = child(g, 0);
+      if (y != nullptr && RBTREE_RED(y)) {
+        RBTREE_SET_BLACK(pa[k - 1]);
+        RBTREE_SET_BLACK(y);
+        RBTREE_SET_RED(g);
+        k -= 2;
+        continue;
+      }
+      y = rotate<A>(g, 0);
+      RBTREE_SET_RED(g);
+      RBTREE_SET_BLACK(y);
+      if (k > 2) {
+        link(pa[k - 3], 1, y);
+      } else {
+        root = y;
+      }
+      memmove(pa + k - 2, pa + k - 1, (path.size() - k + 1) * sizeof(TREE*)); // g leaves the spine
+      path.truncate(path.size() - 1);
+      break;
+    }
+    RBTREE_SET_BLACK(root);
+  }
+
+  // O(log n). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    tree_path<RBTREE_MAX_HEIGHT> path(root);
+    TREE* p = path.find(t, compare);
+    if (p == nullptr) {
+      return nullptr;
+    }
+
+    TREE* s = path.splice(p);
+    bool red = RBTREE_RED(s != nullptr ? s : p); // color of the position that goes away
+    if (s != nullptr) {
+      set_color(s, RBTREE_RED(p));
+    }
+    path.update<A>();
+
+    TREE** pa = path.pa;
+    int* da = path.da;
+    int& k = path.k;
+    while (!red) {
+      TREE* x = child(pa[k - 1], da[k - 1]);
+      if (x != nullptr && RBTREE_RED(x)) {
+        RBTREE_SET_BLACK(x);
+        break;
+      }
+      if (k < 2) {
+        break;
+      }
+
+      int d = da[k - 1];
+      TREE* w = child(pa[k - 1], !d);
+      if (RBTREE_RED(w)) {
+        RBTREE_SET_BLACK(w);
+        RBTREE_SET_RED(pa[k - 1]);
+        link(pa[k - 2], da[k - 2], rotate<A>(pa[k - 1], d));
+        pa[k] = pa[k - 1];
+        da[k] = d;
+        pa[k - 1] = w;
+        k++;
+        w = child(pa[k - 1], !d);
+      }
+
+      TREE* near = child(w, d);
+      TREE* far = child(w, !d);
+      if ((near == nullptr || !RBTREE_RED(near)) && (far == nullptr || !RBTREE_RED(far))) {
+        RBTREE_SET_RED(w);
+        k--;
+        continue;
+      }
+      if (far == nullptr || !RBTREE_RED(far)) {
+        RBTREE_SET_BLACK(near);
+        RBTREE_SET_RED(w);
+        link(pa[k - 1], !d, rotate<A>(w, !d));
+        w = near;
+      }
+      set_color(w, RBTREE_RED(pa[k - 1]));
+      RBTREE_SET_BLACK(pa[k - 1]);
+      RBTREE_SET_BLACK(child(w, !d));
+      link(pa[k - 2], da[k - 2], rotate<A>(pa[k - 1], d));
+      break;
+    }
+
+    root = path.root();
+    TREE_INIT(p);
+    return p;
+  }
+
+  // as intrusive_bst::build. O(n), only a partial deepest level is red
+  template <typename I, typename F> void build(I first, size_t n, F&& node) {
+    intrusive_bst::build(first, n, node);
+    if (empty()) {
+      return;
+    }
+    size_t h = 0;
+    for (size_t m = n; m > 0; m >>= 1) {
+      h++;
+    }
+    if (((n + 1) & n) != 0) {
+      iterate_levels(h - 1, [](TREE* t) { RBTREE_SET_RED(t); }, root);
+    }
+    if (!std::is_same<A, tree_no_augment>::value) {
+      iterate_postorder([](TREE* t) { A::update(t); }, root);
+    }
+  }
+
+  void build(TREE** ts, size_t n) {
+    build(ts, n, [](TREE* t) { return t; });
+  }
+
+private:
+  // hangs t from the end of the path and fixes colors up it
+  void attach(TREE* t, tree_path<RBTREE_MAX_HEIGHT>& path) noexcept {
+    TREE** pa = path.pa;
+    int* da = path.da;
+    int k = path.k;
+    TREE_INIT(t);
+    RBTREE_SET_RED(t);
+    A::update(t);
+    link(pa[k - 1], da[k - 1], t);
+    path.update<A>();
+
+    while (k >= 3 && RBTREE_RED(pa[k - 1])) {
+      int d = da[k - 2];
+      TREE* g = pa[k - 2];
+      TREE* y = child(g, !d);
+      if (y != nullptr && RBTREE_RED(y)) {
+        RBTREE_SET_BLACK(pa[k - 1]);
+        RBTREE_SET_BLACK(y);
+        RBTREE_SET_RED(g);
+        k -= 2;
+        continue;
+      }
+      if (da[k - 1] != d) {
+        link(g, d, rotate<A>(pa[k - 1], d));
+      }
+      y = rotate<A>(g, !d);
+      RBTREE_SET_RED(g);
+      RBTREE_SET_BLACK(y);
+      link(pa[k - 3], da[k - 3], y);
+      break;
+    }
+
+    root = path.root();
+    RBTREE_SET_BLACK(root);
+  }
+
+  static void set_color(TREE* t, bool red) noexcept {
+    if (red) {
+      RBTREE_SET_RED(t);
+    } else {
+      RBTREE_SET_BLACK(t);
+    }
+  }
+
+};
+
+typedef basic_rbtree<tree_no_augment> intrusive_rbtree;
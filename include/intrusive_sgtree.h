@@ -0,0 +1,73 @@
+#pragma once
+#include "intrusive_bst.h"
+
+// alpha is 2/3, so no node sits deeper than log1.5(n) + 1, plus the head
+#define SGTREE_MAX_HEIGHT 128
+
+// scapegoat tree over bare TREE nodes. Amortized O(log n) updates, O(log n) lookups
+struct intrusive_sgtree : intrusive_bst_base {
+  size_t count = 0;
+  size_t most = 0; // largest count since the whole tree was last rebuilt
+
+  void clear() noexcept {
+    root = nullptr;
+    count = 0;
+    most = 0;
+  }
+
+  // O(1)
+  size_t size() const noexcept { return count; }
+
+  // amortized O(log n)
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    tree_path<SGTREE_MAX_HEIGHT> path(root);
+    path.descend(t, compare);
+    TREE** pa = path.pa;
+    int* da = path.da;
+    int k = path.k;
+    TREE_INIT(t);
+    link(pa[k - 1], da[k - 1], t);
+    count++;
+    most = count > most ? count : most;
+
+    // too deep, rebuild the nearest ancestor with over 2/3 of its nodes on one side
+    if (size_t(k - 1) > depth(count)) {
+      size_t n = 1;
+      for (int j = k - 1; j > 0; j--) {
+        size_t s = intrusive_bst::size(child(pa[j], !da[j]));
+        size_t total = n + 1 + s;
+        if (3 * (n > s ? n : s) > 2 * total) {
+          link(pa[j - 1], da[j - 1], balance(pa[j]));
+          break;
+        }
+        n = total;
+      }
+    }
+    root = path.root();
+  }
+
+  // amortized O(log n). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    TREE* p = intrusive_bst::erase(t, compare);
+    if (p == nullptr) {
+      return nullptr;
+    }
+    count--;
+    if (3 * count < 2 * most) {
+      root = balance(root);
+      most = count;
+    }
+    return p;
+  }
+
+private:
+  // the deepest a node may sit among n, floor(log1.5(n))
+  static size_t depth(size_t n) noexcept {
+    size_t d = 0;
+    for (double x = 1.5; x <= double(n); x *= 1.5) {
+      d++;
+    }
+    return d;
+  }
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include "intrusive_bst.h"
+
+// top-down splay tree over bare TREE nodes. Amortized O(log n).
+// insert, erase and find splay, the other lookups leave the shape alone
+struct intrusive_splaytree : intrusive_bst_base {
+  using intrusive_bst::rebalance;
+
+  // amortized O(log n). t becomes the root, after any node equal to it
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    TREE_INIT(t);
+    if (!empty()) {
+      TREE* r = splay(root, [&](TREE* p) { return compare(t, p) ? -1 : 1; });
+      int dir = compare(t, r) ? 0 : 1;
+      link(t, dir, child(r, dir));
+      link(t, !dir, r);
+      link(r, dir, nullptr);
+    }
+    root = t;
+  }
+
+  // amortized O(log n). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    if (empty()) {
+      return nullptr;
+    }
+    TREE* p = root = splay(root, [&](TREE* r) { return tree_order(compare, t, r); });
+    if (tree_order(compare, t, p) != 0) {
+      return nullptr;
+    }
+    TREE* l = child(p, 0);
+    if (l != nullptr) { // the largest node on the left has no right child left once on top
+      l = splay(l, [](TREE*) { return 1; });
+      link(l, 1, child(p, 1));
+      root = l;
+    } else {
+      root = child(p, 1);
+    }
+    TREE_INIT(p);
+    return p;
+  }
+
+  // amortized O(log n). The node equal to key or the last one met becomes the root
+  template <typename K, typename C> TREE* find(const K& key, C&& compare) noexcept {
+    if (empty()) {
+      return nullptr;
+    }
+    root = splay(root, [&](TREE* t) { return compare(key, t); });
+    return compare(key, root) == 0 ? root : nullptr;
+  }
+
+private:
+  // top down, order(t) is <0, 0 or >0 like a compare
+  template <typename O> static TREE* splay(TREE* t, O&& order) noexcept {
+    TREE head; // left link holds what ends up right of t, right link what ends up left of it
+    TREE_INIT(&head);
+    TREE* l = &head; // largest on the left so far
+    TREE* r = &head; // smallest on the right so far
+    for (;;) {
+      int c = order(t);
+      if (c == 0) {
+        break;
+      }
+      int dir = c > 0;
+      TREE* y = child(t, dir);
+      if (y == nullptr) {
+        break;
+      }
+      int cy = order(y);
+      if (dir ? cy > 0 : cy < 0) { // zig-zig, rotate first
+        link(t, dir, child(y, !dir));
+        link(y, !dir, t);
+        t = y;
+        y = child(t, dir);
+        if (y == nullptr) {
+          break;
+        }
+      }
+      if (dir) {
+        link(l, 1, t);
+        l = t;
+      } else {
+        link(r, 0, t);
+        r = t;
+      }
+      t = y;
+    }
+    link(l, 1, child(t, 0));
+    link(r, 0, child(t, 1));
+    link(t, 0, child(&head, 1));
+    link(t, 1, child(&head, 0));
+    return t;
+  }
+};
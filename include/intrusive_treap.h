@@ -0,0 +1,255 @@
+#pragma once
+#include <future>
+
+#include "intrusive_bst.h"
+
+// treap over bare TREE nodes, the heap priority is a hash of the node address. Expected O(log n) depth
+struct intrusive_treap : intrusive_bst_base {
+  // murmur3's finalizer, a bijection so distinct nodes never tie
+  static uint64_t priority(TREE* t) noexcept {
+    uint64_t x = (uint64_t)(uintptr_t)t;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+  }
+
+  // expected O(log n), t after any node equal to it
+  template <typename L> void insert(TREE* t, L&& compare) {
+    TREE_ASSERT_LESS(L);
+    TREE_INIT(t);
+    uint64_t pt = priority(t);
+    TREE* parent = nullptr;
+    int dir = 0;
+    TREE* s = root;
+    while (s != nullptr && priority(s) > pt) {
+      parent = s;
+      dir = !compare(t, s);
+      s = child(s, dir);
+    }
+    split(s, [&](TREE* x) { return compare(t, x); }, t, 0, t, 1);
+    if (parent != nullptr) {
+      link(parent, dir, t);
+    } else {
+      root = t;
+    }
+  }
+
+  // expected O(log n). Removes one node equal to t, returns it or nullptr
+  template <typename L> TREE* erase(TREE* t, L&& compare) {
+    TREE* parent = nullptr;
+    int dir = 0;
+    TREE* p = root;
+    while (p != nullptr) {
+      int o = tree_order(compare, t, p);
+      if (o == 0) {
+        break;
+      }
+      dir = o > 0;
+      parent = p;
+      p = child(p, dir);
+    }
+    if (p == nullptr) {
+      return nullptr;
+    }
+    TREE* s = join(child(p, 0), child(p, 1));
+    if (parent != nullptr) {
+      link(parent, dir, s);
+    } else {
+      root = s;
+    }
+    TREE_INIT(p);
+    return p;
+  }
+
+  // expected O(log n). The nodes from lower_bound(key) on move to q, which must be empty
+  template <typename K, typename C> void split(const K& key, C&& compare, intrusive_treap& q) noexcept {
+    assert(q.empty());
+    TREE head;
+    TREE_INIT(&head);
+    split(root, [&](TREE* x) { return compare(key, x) <= 0; }, &head, 1, &head, 0);
+    root = child(&head, 1);
+    q.root = child(&head, 0);
+  }
+
+  // expected O(log n). The nodes of q, all ordered after those here, move to the end
+  void append(intrusive_treap& q) noexcept {
+    root = join(root, q.root);
+    q.root = nullptr;
+  }
+
+  // expected O(m log(n / m + 1)) for sizes m <= n. Keys are unique within each tree.
+  // The result is left here and q ends up empty. Nodes left out go to dispose after TREE_INIT.
+  // With threads > 1, compare and dispose must be thread safe
+
+  // the nodes of both, a node of q equal to one here is disposed
+  template <typename L, typename D> void unite(intrusive_treap& q, L&& compare, D&& dispose, unsigned threads = 1) {
+    TREE_ASSERT_LESS(L);
+    root = unite(root, q.root, compare, dispose, threads);
+    q.root = nullptr;
+  }
+
+  // the nodes here with an equal one in q
+  template <typename L, typename D> void intersect(intrusive_treap& q, L&& compare, D&& dispose, unsigned threads = 1) {
+    TREE_ASSERT_LESS(L);
+    root = intersect(root, q.root, compare, dispose, threads);
+    q.root = nullptr;
+  }
+
+  // the nodes here without an equal one in q
+  template <typename L, typename D> void subtract(intrusive_treap& q, L&& compare, D&& dispose, unsigned threads = 1) {
+    TREE_ASSERT_LESS(L);
+    root = subtract(root, q.root, compare, dispose, threads);
+    q.root = nullptr;
+  }
+
+private:
+  template <typename L, typename D>
+  TREE* unite(TREE* a, TREE* b, L& compare, D& dispose, unsigned threads) const {
+    if (a == nullptr || b == nullptr) {
+      return a != nullptr ? a : b;
+    }
+    TREE *l, *m, *r, *lu, *ru;
+    if (priority(a) > priority(b)) {
+      split(b, a, compare, l, m, r);
+      drop(m, dispose);
+      fork(threads, lu, ru,
+           [&](int dir, unsigned n) { return unite(child(a, dir), dir ? r : l, compare, dispose, n); });
+      link(a, 0, lu);
+      link(a, 1, ru);
+      return a;
+    }
+    split(a, b, compare, l, m, r); // b goes on top unless a holds its equal
+    fork(threads, lu, ru, [&](int dir, unsigned n) { return unite(dir ? r : l, child(b, dir), compare, dispose, n); });
+    if (m == nullptr) {
+      link(b, 0, lu);
+      link(b, 1, ru);
+      return b;
+    }
+    TREE_INIT(b);
+    dispose(b);
+    return join(join(lu, m), ru);
+  }
+
+  template <typename L, typename D>
+  TREE* intersect(TREE* a, TREE* b, L& compare, D& dispose, unsigned threads) const {
+    if (a == nullptr || b == nullptr) {
+      drop(a != nullptr ? a : b, dispose);
+      return nullptr;
+    }
+    TREE *l, *m, *r, *li, *ri;
+    split(b, a, compare, l, m, r);
+    fork(threads, li, ri,
+         [&](int dir, unsigned n) { return intersect(child(a, dir), dir ? r : l, compare, dispose, n); });
+    if (m != nullptr) {
+      drop(m, dispose);
+      link(a, 0, li);
+      link(a, 1, ri);
+      return a;
+    }
+    TREE_INIT(a);
+    dispose(a);
+    return join(li, ri);
+  }
+
+  template <typename L, typename D>
+  TREE* subtract(TREE* a, TREE* b, L& compare, D& dispose, unsigned threads) const {
+    if (a == nullptr || b == nullptr) {
+      drop(b, dispose);
+      return a;
+    }
+    TREE *l, *m, *r, *ls, *rs;
+    split(b, a, compare, l, m, r);
+    fork(threads, ls, rs,
+         [&](int dir, unsigned n) { return subtract(child(a, dir), dir ? r : l, compare, dispose, n); });
+    if (m == nullptr) {
+      link(a, 0, ls);
+      link(a, 1, rs);
+      return a;
+    }
+    drop(m, dispose);
+    TREE_INIT(a);
+    dispose(a);
+    return join(ls, rs);
+  }
+
+  // f(0, n) into l on its own thread while threads remain, f(1, n) into r
+  template <typename F> static void fork(unsigned threads, TREE*& l, TREE*& r, F&& f) {
+    if (threads > 1) {
+      std::future<TREE*> left = std::async(std::launch::async, f, 0, threads / 2);
+      r = f(1, threads - threads / 2);
+      l = left.get();
+    } else {
+      l = f(0, 1);
+      r = f(1, 1);
+    }
+  }
+
+  // disposes every node below s, children first
+  template <typename D> void drop(TREE* s, D& dispose) const {
+    if (s != nullptr) {
+      iterate_postorder(
+          [&dispose](TREE* t) {
+            TREE_INIT(t);
+            dispose(t);
+          },
+          s);
+    }
+  }
+
+  // s cut into the nodes before t, those equal to it and those after it
+  template <typename L> static void split(TREE* s, TREE* t, L& compare, TREE*& l, TREE*& m, TREE*& r) {
+    TREE_ASSERT_LESS(L);
+    TREE head;
+    TREE_INIT(&head);
+    split(s, [&](TREE* x) { return compare(t, x); }, &head, 1, &head, 0);
+    r = child(&head, 0);
+    split(child(&head, 1), [&](TREE* x) { return !compare(x, t); }, &head, 1, &head, 0);
+    l = child(&head, 1);
+    m = child(&head, 0);
+  }
+
+  // s cut in two, nodes with after(x) go to r from its rd link, the others to l from its ld link
+  template <typename P> static void split(TREE* s, P&& after, TREE* l, int ld, TREE* r, int rd) noexcept {
+    while (s != nullptr) {
+      if (after(s)) {
+        link(r, rd, s);
+        r = s;
+        rd = 0;
+        s = child(s, 0);
+      } else {
+        link(l, ld, s);
+        l = s;
+        ld = 1;
+        s = child(s, 1);
+      }
+    }
+    link(l, ld, nullptr);
+    link(r, rd, nullptr);
+  }
+
+  // a and b merged, every node of a ordered before b
+  static TREE* join(TREE* a, TREE* b) noexcept {
+    TREE head;
+    TREE_INIT(&head);
+    TREE* tail = &head;
+    int dir = 0;
+    while (a != nullptr && b != nullptr) {
+      if (priority(a) > priority(b)) {
+        link(tail, dir, a);
+        tail = a;
+        dir = 1;
+        a = child(a, 1);
+      } else {
+        link(tail, dir, b);
+        tail = b;
+        dir = 0;
+        b = child(b, 0);
+      }
+    }
+    link(tail, dir, a != nullptr ? a : b);
+    return child(&head, 0);
+  }
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <functional>
+
+#include "intrusive_bst.h"
+
+// the T and byte offset of its TREE member field that intrusive_tree takes, as in intrusive_tree<TREE_MEMBER(T, node)>
+#define TREE_MEMBER(T, field) T, offsetof(T, field)
+
+// typed view over a Tree of T linked through the TREE Offset bytes in, Compare is inlined into every descent
+template <typename T, size_t Offset, typename Compare = std::less<T>, typename Tree = intrusive_bst>
+struct intrusive_tree {
+  static_assert(std::is_standard_layout<T>::value, "offsetof only holds for standard layout types");
+
+  static T* data(TREE* t) noexcept { return t == nullptr ? nullptr : (T*)((char*)t - Offset); }
+  static TREE* node(T* x) noexcept { return (TREE*)((char*)x + Offset); }
+
+  struct less {
+    const Compare& compare;
+    bool operator()(TREE* t1, TREE* t2) const { return compare(*data(t1), *data(t2)); }
+  };
+
+  // three way order of a key against a node
+  template <typename K> struct order {
+    const Compare& compare;
+    int operator()(const K& key, TREE* t) const {
+      const T& x = *data(t);
+      return compare(key, x) ? -1 : (compare(x, key) ? 1 : 0);
+    }
+  };
+
+  Tree tree;
+  Compare compare;
+
+  intrusive_tree() : compare() {}
+  explicit intrusive_tree(const Compare& c) : compare(c) {}
+
+  bool empty() const noexcept { return tree.empty(); }
+  void clear() { tree.clear(); }
+  size_t size() const noexcept { return tree.size(); }
+  size_t height() const noexcept { return tree.height(); }
+
+  T* min() const noexcept { return data(tree.min(tree.root)); }
+  T* max() const noexcept { return data(tree.max(tree.root)); }
+
+  void insert(T* x) {
+    TREE_INIT(node(x));
+    tree.insert(node(x), less{compare});
+  }
+
+  // x, or the equal element already in
+  T* insert_unique(T* x) { return data(tree.insert_unique(node(x), less{compare})); }
+
+  // removes one element equal to x
+  T* erase(T* x) { return data(tree.erase(node(x), less{compare})); }
+
+  template <typename K> T* find(const K& key) const noexcept { return data(tree.find(key, lookup<K>())); }
+  template <typename K> T* lower_bound(const K& key) const noexcept { return data(tree.lower_bound(key, lookup<K>())); }
+  template <typename K> T* upper_bound(const K& key) const noexcept { return data(tree.upper_bound(key, lookup<K>())); }
+
+  template <typename K> std::pair<T*, T*> equal_range(const K& key) const noexcept {
+    std::pair<TREE*, TREE*> r = tree.equal_range(key, lookup<K>());
+    return std::make_pair(data(r.first), data(r.second));
+  }
+
+  // f takes T* in place of TREE*
+  template <typename F, typename... Args> void iterate(tree_traverse_t traverse, F&& f, Args&&... args) const noexcept {
+    tree.iterate(traverse, [&](TREE* t) { return f(data(t), args...); });
+  }
+
+  template <typename K, typename F, typename... Args>
+  void iterate_range(const K& lo, const K& hi, F&& f, Args&&... args) const noexcept {
+    tree.iterate_range(lo, hi, lookup<K>(), [&](TREE* t) { return f(data(t), args...); });
+  }
+
+private:
+  template <typename K> order<K> lookup() const noexcept { return order<K>{compare}; }
+};
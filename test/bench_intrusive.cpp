@@ -0,0 +1,770 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+#include "intrusive_avltree.h"
+#include "intrusive_bptree.h"
+#include "intrusive_bst.h"
+#include "intrusive_dswtree.h"
+#include "intrusive_frozen.h"
+#include "intrusive_itree.h"
+#include "intrusive_mtree.h"
+#include "intrusive_prbtree.h"
+#include "intrusive_rbtree.h"
+#include "intrusive_sgtree.h"
+#include "intrusive_splaytree.h"
+#include "intrusive_treap.h"
+#include "intrusive_tree.h"
+
+struct B {
+  int64_t v;
+  TREE node;
+  B(int64_t i) : v(i) { TREE_INIT(&node); }
+};
+
+#define GETB(x) TREE_DATA(x, B, node)
+
+bool compareB(TREE* t1, TREE* t2) { return GETB(t1)->v < GETB(t2)->v; }
+
+int compareKey(int64_t k, TREE* t) { return k < GETB(t)->v ? -1 : (k > GETB(t)->v ? 1 : 0); }
+
+struct lessB {
+  bool operator()(const B& b1, const B& b2) const { return b1.v < b2.v; }
+  bool operator()(int64_t k, const B& b) const { return k < b.v; }
+  bool operator()(const B& b, int64_t k) const { return b.v < k; }
+};
+
+// keys 0..n-1 in a fixed random order
+std::vector<B> shuffled(size_t n) {
+  std::vector<int64_t> keys(n);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = int64_t(i);
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(n));
+  return std::vector<B>(keys.begin(), keys.end());
+}
+
+TEST_CASE("bst erase", "[bench]") {
+  for (size_t n : {1000, 10000, 100000, 1000000}) {
+    std::vector<B> bs = shuffled(n);
+    intrusive_bst bst;
+    for (auto& b : bs) {
+      bst.insert(&b.node, compareB);
+    }
+
+    size_t i = 0;
+    BENCHMARK("erase and insert back, n = " + std::to_string(n)) {
+      TREE* t = bst.erase(&bs[i++ % n].node, compareB);
+      bst.insert(t, compareB);
+      return t;
+    };
+  }
+}
+
+TEST_CASE("bst insert and walk", "[bench]") {
+  for (size_t n : {1000, 100000}) {
+    std::vector<B> bs = shuffled(n);
+    intrusive_bst bst;
+
+    BENCHMARK("insert, n = " + std::to_string(n)) {
+      bst.clear();
+      for (auto& b : bs) {
+        TREE_INIT(&b.node);
+        bst.insert(&b.node, compareB);
+      }
+      return bst.root;
+    };
+
+    BENCHMARK("inorder, n = " + std::to_string(n)) {
+      int64_t sum = 0;
+      bst.iterate(TREE_TRAVERSE_INORDER, [&sum](TREE* t) { sum += GETB(t)->v; });
+      return sum;
+    };
+
+    BENCHMARK("inorder morris, n = " + std::to_string(n)) {
+      int64_t sum = 0;
+      bst.iterate_morris([&sum](TREE* t) { sum += GETB(t)->v; }, bst.root);
+      return sum;
+    };
+
+    BENCHMARK("postorder, n = " + std::to_string(n)) {
+      int64_t sum = 0;
+      bst.iterate(TREE_TRAVERSE_POSTORDER, [&sum](TREE* t) { sum += GETB(t)->v; });
+      return sum;
+    };
+
+    BENCHMARK("height, n = " + std::to_string(n)) { return bst.height(); };
+  }
+}
+
+TEST_CASE("bst function pointer vs typed", "[bench]") {
+  const size_t n = 10000;
+  std::vector<B> bs = shuffled(n);
+  intrusive_bst bst;
+  intrusive_tree<TREE_MEMBER(B, node), lessB> tree;
+
+  BENCHMARK("insert, TREE_LESS_T") {
+    bst.clear();
+    for (auto& b : bs) {
+      TREE_INIT(&b.node);
+      bst.insert(&b.node, compareB);
+    }
+    return bst.root;
+  };
+
+  BENCHMARK("find, function pointer") {
+    size_t found = 0;
+    for (int64_t k = 0; k < int64_t(n); k++) {
+      found += bst.find(k, compareKey) != nullptr;
+    }
+    return found;
+  };
+
+  BENCHMARK("insert, intrusive_tree") {
+    tree.clear();
+    for (auto& b : bs) {
+      tree.insert(&b);
+    }
+    return tree.tree.root;
+  };
+
+  BENCHMARK("find, intrusive_tree") {
+    size_t found = 0;
+    for (int64_t k = 0; k < int64_t(n); k++) {
+      found += tree.find(k) != nullptr;
+    }
+    return found;
+  };
+}
+
+TEST_CASE("bst bfs", "[bench]") {
+  for (size_t n : {1000, 100000}) {
+    std::vector<B> bs = shuffled(n);
+    intrusive_bst bst;
+    for (auto& b : bs) {
+      bst.insert(&b.node, compareB);
+    }
+
+    BENCHMARK("std::deque, n = " + std::to_string(n)) {
+      int64_t sum = 0;
+      std::deque<TREE*> ts;
+      ts.push_back(bst.root);
+      while (!ts.empty()) {
+        TREE* t = ts.front();
+        ts.pop_front();
+        sum += GETB(t)->v;
+        if (!LEFT_EMPTY(t))
+          ts.push_back(TREE_LCHILD(t));
+        if (!RIGHT_EMPTY(t))
+          ts.push_back(TREE_RCHILD(t));
+      }
+      return sum;
+    };
+
+    BENCHMARK("iterate_bfs, n = " + std::to_string(n)) {
+      int64_t sum = 0;
+      bst.iterate(TREE_TRAVERSE_BFS, [&sum](TREE* t) { sum += GETB(t)->v; });
+      return sum;
+    };
+
+    std::vector<TREE*> ring(n);
+    BENCHMARK("ring of n, n = " + std::to_string(n)) {
+      int64_t sum = 0;
+      bst.iterate_bfs_ring(ring.data(), ring.size(), [&sum](TREE* t) { sum += GETB(t)->v; }, bst.root);
+      return sum;
+    };
+
+    BENCHMARK("levels only, n = " + std::to_string(n)) {
+      int64_t sum = 0;
+      bst.iterate_levels(0, [&sum](TREE* t) { sum += GETB(t)->v; }, bst.root);
+      return sum;
+    };
+  }
+}
+
+// builds Tree from bs in their order, then finds every key in a random order
+template <typename Tree> void lookups(const std::string& name, std::vector<B>& bs) {
+  Tree tree;
+  for (auto& b : bs) {
+    TREE_INIT(&b.node);
+    tree.insert(&b.node, compareB);
+  }
+  std::vector<int64_t> keys(bs.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    keys[i] = int64_t(i);
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(0));
+
+  BENCHMARK(name + ", height " + std::to_string(tree.height())) {
+    size_t found = 0;
+    for (int64_t k : keys) {
+      found += tree.find(k, compareKey) != nullptr;
+    }
+    return found;
+  };
+}
+
+TEST_CASE("bst lookup heavy", "[bench]") {
+  for (size_t n : {1000, 100000}) {
+    std::vector<B> bs = shuffled(n);
+    std::string suffix = ", random, n = " + std::to_string(n);
+    lookups<intrusive_bst>("bst" + suffix, bs);
+    lookups<intrusive_rbtree>("rbtree" + suffix, bs);
+    lookups<intrusive_avltree>("avltree" + suffix, bs);
+    lookups<intrusive_sgtree>("sgtree" + suffix, bs);
+    lookups<intrusive_treap>("treap" + suffix, bs);
+  }
+
+  // ascending keys, the plain tree turns into a list
+  std::vector<B> bs = shuffled(10000);
+  std::sort(bs.begin(), bs.end(), [](const B& b1, const B& b2) { return b1.v < b2.v; });
+  lookups<intrusive_bst>("bst, ascending, n = 10000", bs);
+  lookups<intrusive_rbtree>("rbtree, ascending, n = 10000", bs);
+  lookups<intrusive_avltree>("avltree, ascending, n = 10000", bs);
+  lookups<intrusive_sgtree>("sgtree, ascending, n = 10000", bs);
+  lookups<intrusive_treap>("treap, ascending, n = 10000", bs);
+}
+
+// inserts bs in their order into a fresh Tree
+template <typename Tree> void load(const std::string& name, std::vector<B>& bs) {
+  BENCHMARK(std::string(name)) {
+    Tree tree;
+    for (auto& b : bs) {
+      tree.insert(&b.node, compareB);
+    }
+    return tree.root;
+  };
+}
+
+TEST_CASE("bst sorted load", "[bench]") {
+  std::vector<B> bs = shuffled(100000);
+  std::sort(bs.begin(), bs.end(), [](const B& b1, const B& b2) { return b1.v < b2.v; });
+  load<intrusive_dswtree>("dswtree, ascending, n = 100000", bs);
+  load<intrusive_sgtree>("sgtree, ascending, n = 100000", bs);
+  load<intrusive_rbtree>("rbtree, ascending, n = 100000", bs);
+  load<intrusive_avltree>("avltree, ascending, n = 100000", bs);
+  load<intrusive_treap>("treap, ascending, n = 100000", bs);
+}
+
+// n keys drawn with probability proportional to 1 / rank^s, ranks spread over the keys at random
+std::vector<int64_t> zipfian(size_t keys, size_t n, double s) {
+  std::vector<double> cdf(keys);
+  double sum = 0;
+  for (size_t i = 0; i < keys; i++) {
+    sum += 1.0 / pow(double(i + 1), s);
+    cdf[i] = sum;
+  }
+  std::vector<int64_t> ranked(keys);
+  for (size_t i = 0; i < keys; i++) {
+    ranked[i] = int64_t(i);
+  }
+  std::mt19937_64 g(keys + n);
+  std::shuffle(ranked.begin(), ranked.end(), g);
+  std::uniform_real_distribution<double> u(0, sum);
+  std::vector<int64_t> v(n);
+  for (auto& k : v) {
+    k = ranked[std::lower_bound(cdf.begin(), cdf.end(), u(g)) - cdf.begin()];
+  }
+  return v;
+}
+
+// nodes met from the root down to key
+size_t depth(TREE* t, int64_t key) {
+  size_t d = 1;
+  for (int c; (c = compareKey(key, t)) != 0; d++) {
+    t = intrusive_bst::child(t, c > 0);
+  }
+  return d;
+}
+
+template <typename Tree> void skewed(const std::string& name, std::vector<B>& bs, const std::vector<int64_t>& keys) {
+  Tree tree;
+  for (auto& b : bs) {
+    TREE_INIT(&b.node);
+    tree.insert(&b.node, compareB);
+  }
+  size_t total = 0;
+  for (int64_t k : keys) {
+    total += depth(tree.root, k);
+    tree.find(k, compareKey);
+  }
+  char mean[32];
+  snprintf(mean, sizeof(mean), "%.1f", double(total) / double(keys.size()));
+
+  BENCHMARK(name + ", mean depth " + mean) {
+    size_t found = 0;
+    for (int64_t k : keys) {
+      found += tree.find(k, compareKey) != nullptr;
+    }
+    return found;
+  };
+}
+
+TEST_CASE("bst zipfian lookups", "[bench]") {
+  const size_t n = 100000;
+  std::vector<B> bs = shuffled(n);
+  for (double s : {0.99, 1.3}) {
+    std::vector<int64_t> keys = zipfian(n, n, s);
+    std::string suffix = ", s = " + std::to_string(s).substr(0, 4);
+    skewed<intrusive_bst>("bst" + suffix, bs, keys);
+    skewed<intrusive_rbtree>("rbtree" + suffix, bs, keys);
+    skewed<intrusive_avltree>("avltree" + suffix, bs, keys);
+    skewed<intrusive_splaytree>("splaytree" + suffix, bs, keys);
+  }
+}
+
+// erases and inserts back every node of a Tree built from bs, compares per node counted once beforehand
+template <typename Tree> void churn(const std::string& name, std::vector<B>& bs) {
+  Tree tree;
+  for (auto& b : bs) {
+    TREE_INIT(&b.node);
+    tree.insert(&b.node, compareB);
+  }
+  size_t compares = 0;
+  auto counted = [&compares](TREE* t1, TREE* t2) {
+    compares++;
+    return compareB(t1, t2);
+  };
+  for (auto& b : bs) {
+    tree.insert(tree.erase(&b.node, counted), counted);
+  }
+  char per[32];
+  snprintf(per, sizeof(per), "%.1f", double(compares) / double(bs.size()));
+
+  BENCHMARK(name + ", compares " + per) {
+    for (auto& b : bs) {
+      tree.insert(tree.erase(&b.node, compareB), compareB);
+    }
+    return tree.root;
+  };
+}
+
+TEST_CASE("bst write heavy", "[bench]") {
+  std::vector<B> bs = shuffled(100000);
+  churn<intrusive_rbtree>("rbtree", bs);
+  churn<intrusive_avltree>("avltree", bs);
+  churn<intrusive_treap>("treap", bs);
+  churn<intrusive_bst>("bst", bs);
+}
+
+// a fresh pair of treaps for every run, the multiples of 2 and of 3 below 3n / 2, n nodes each
+template <typename Op> void reconcile(const std::string& name, size_t n, Op op) {
+  BENCHMARK_ADVANCED(std::string(name))(Catch::Benchmark::Chronometer meter) {
+    std::vector<std::vector<B>> as(meter.runs()), bs(meter.runs());
+    std::vector<intrusive_treap> a(meter.runs()), b(meter.runs());
+    for (int i = 0; i < meter.runs(); i++) {
+      as[i] = shuffled(n);
+      bs[i] = shuffled(n);
+      for (auto& x : as[i]) {
+        x.v *= 2;
+        a[i].insert(&x.node, compareB);
+      }
+      for (auto& x : bs[i]) {
+        x.v = x.v * 3 / 2;
+        b[i].insert(&x.node, compareB);
+      }
+    }
+    meter.measure([&](int i) {
+      op(a[i], b[i]);
+      return a[i].root;
+    });
+  };
+}
+
+TEST_CASE("treap set operations", "[bench]") {
+  const size_t n = 200000;
+  auto dispose = [](TREE*) {};
+  for (unsigned threads : {1, 2, 4}) {
+    std::string suffix = ", " + std::to_string(threads) + " threads, n = " + std::to_string(n);
+    reconcile("unite" + suffix, n,
+              [&](intrusive_treap& a, intrusive_treap& b) { a.unite(b, compareB, dispose, threads); });
+    reconcile("intersect" + suffix, n,
+              [&](intrusive_treap& a, intrusive_treap& b) { a.intersect(b, compareB, dispose, threads); });
+    reconcile("subtract" + suffix, n,
+              [&](intrusive_treap& a, intrusive_treap& b) { a.subtract(b, compareB, dispose, threads); });
+  }
+  reconcile("unite by single inserts, n = " + std::to_string(n), n, [](intrusive_treap& a, intrusive_treap& b) {
+    while (!b.empty()) {
+      TREE* t = b.erase(b.root, compareB);
+      if (a.find(GETB(t)->v, compareKey) == nullptr) {
+        a.insert(t, compareB);
+      }
+    }
+  });
+}
+
+TEST_CASE("bst bulk build", "[bench]") {
+  const size_t n = 1000000;
+  std::vector<B> bs = shuffled(n);
+  std::sort(bs.begin(), bs.end(), [](const B& b1, const B& b2) { return b1.v < b2.v; });
+  std::vector<TREE*> ts;
+  for (auto& b : bs) {
+    ts.push_back(&b.node);
+  }
+
+  BENCHMARK("rbtree, n inserts, n = " + std::to_string(n)) {
+    intrusive_rbtree rb;
+    for (TREE* t : ts) {
+      rb.insert(t, compareB);
+    }
+    return rb.root;
+  };
+
+  BENCHMARK("rbtree, build, n = " + std::to_string(n)) {
+    intrusive_rbtree rb;
+    rb.build(ts.data(), n);
+    return rb.root;
+  };
+
+  BENCHMARK("bst, build, n = " + std::to_string(n)) {
+    intrusive_bst bst;
+    bst.build(ts.data(), n);
+    return bst.root;
+  };
+}
+
+// a timestamp into rb from the root, hinted at end(), or appended after the last node with a hint only when late
+template <typename C> void stamp(int how, intrusive_rbtree& rb, intrusive_rbtree::iterator& last, B& b, C& compare) {
+  if (how == 0) {
+    rb.insert(&b.node, compare);
+  } else if (how == 1) {
+    rb.insert_hint(rb.end(), &b.node, compare);
+  } else if (rb.empty() || !compare(&b.node, *last)) {
+    rb.insert_max(last, &b.node);
+  } else {
+    rb.insert_hint(last, &b.node, compare);
+    last = --rb.end();
+  }
+}
+
+// the compares a node takes on average in the name
+void stamps(const std::string& name, std::vector<B>& bs) {
+  const char* hows[] = {"insert", "insert_hint at end()", "insert_max, else insert_hint"};
+  for (int how = 0; how < 3; how++) {
+    size_t compares = 0;
+    auto counted = [&compares](TREE* t1, TREE* t2) {
+      compares++;
+      return compareB(t1, t2);
+    };
+    intrusive_rbtree rb;
+    intrusive_rbtree::iterator last = rb.end();
+    for (auto& b : bs) {
+      stamp(how, rb, last, b, counted);
+    }
+    char per[32];
+    snprintf(per, sizeof(per), "%.1f", double(compares) / double(bs.size()));
+
+    BENCHMARK(name + ", " + hows[how] + ", compares " + per) {
+      intrusive_rbtree tree;
+      intrusive_rbtree::iterator i = tree.end();
+      for (auto& b : bs) {
+        stamp(how, tree, i, b, compareB);
+      }
+      return tree.root;
+    };
+  }
+}
+
+TEST_CASE("bst nearly sorted inserts", "[bench]") {
+  const size_t n = 1000000;
+  std::vector<int64_t> keys(n);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = int64_t(i);
+  }
+  std::vector<B> bs(keys.begin(), keys.end());
+  stamps("monotone, n = " + std::to_string(n), bs);
+
+  // one in ten arrives up to 64 places late
+  std::mt19937_64 rng(n);
+  for (size_t i = 0; i + 65 < n; i++) {
+    if (rng() % 10 == 0) {
+      std::rotate(keys.begin() + i, keys.begin() + i + 1, keys.begin() + i + 2 + rng() % 64);
+    }
+  }
+  bs.assign(keys.begin(), keys.end());
+  stamps("nearly sorted, n = " + std::to_string(n), bs);
+}
+
+int orderB(TREE* t1, TREE* t2) { return GETB(t1)->v < GETB(t2)->v ? -1 : (GETB(t1)->v > GETB(t2)->v ? 1 : 0); }
+
+tree_three_way_compare<TREE_COMPARE_T> orderCompareB(orderB);
+
+// a key into rb unless it is in already, found first then inserted, or in one descent with either comparator
+template <typename L, typename C, typename K>
+void unique(int how, intrusive_rbtree& rb, B& b, L& less, C& compare, K& key) {
+  if (how == 0) {
+    if (rb.find(b.v, key) == nullptr) {
+      rb.insert(&b.node, less);
+    }
+  } else {
+    rb.insert_unique(&b.node, compare);
+  }
+}
+
+TEST_CASE("bst unique inserts", "[bench]") {
+  const size_t n = 200000;
+  std::vector<B> bs = shuffled(n);
+  for (auto& b : bs) {
+    b.v /= 2; // every key twice
+  }
+  const char* hows[] = {"find then insert", "insert_unique, less", "insert_unique, three-way"};
+  for (int how = 0; how < 3; how++) {
+    size_t compares = 0;
+    auto less = [&compares](TREE* t1, TREE* t2) {
+      compares++;
+      return compareB(t1, t2);
+    };
+    auto order = tree_compare([&compares](TREE* t1, TREE* t2) {
+      compares++;
+      return orderB(t1, t2);
+    });
+    auto key = [&compares](int64_t k, TREE* t) {
+      compares++;
+      return compareKey(k, t);
+    };
+    intrusive_rbtree rb;
+    for (auto& b : bs) {
+      if (how == 2) {
+        unique(how, rb, b, less, order, key);
+      } else {
+        unique(how, rb, b, less, less, key);
+      }
+    }
+    char per[32];
+    snprintf(per, sizeof(per), "%.1f", double(compares) / double(bs.size()));
+
+    BENCHMARK(std::string(hows[how]) + ", n = " + std::to_string(n) + ", compares " + per) {
+      intrusive_rbtree tree;
+      for (auto& b : bs) {
+        if (how == 2) {
+          unique(how, tree, b, compareB, orderCompareB, compareKey);
+        } else {
+          unique(how, tree, b, compareB, compareB, compareKey);
+        }
+      }
+      return tree.root;
+    };
+  }
+}
+
+struct PB {
+  int64_t v;
+  PTREE node;
+  PB(int64_t i) : v(i) { PTREE_INIT(&node); }
+};
+
+bool comparePB(TREE* t1, TREE* t2) { return TREE_DATA(t1, PB, node)->v < TREE_DATA(t2, PB, node)->v; }
+
+// a timer cancelled and armed again, by key or by the node held
+TEST_CASE("bst erase by node", "[bench]") {
+  for (size_t n : {10000, 1000000}) {
+    std::vector<B> bs = shuffled(n);
+    intrusive_rbtree rb;
+    for (auto& b : bs) {
+      rb.insert(&b.node, compareB);
+    }
+    std::vector<PB> ps;
+    ps.reserve(n);
+    intrusive_prbtree prb;
+    for (auto& b : bs) {
+      ps.emplace_back(b.v);
+      prb.insert(PTREE_NODE(&ps.back().node), comparePB);
+    }
+
+    size_t i = 0;
+    BENCHMARK("rbtree, erase by key and insert back, n = " + std::to_string(n)) {
+      TREE* t = rb.erase(&bs[i++ % n].node, compareB);
+      rb.insert(t, compareB);
+      return t;
+    };
+
+    i = 0;
+    BENCHMARK("prbtree, erase by node and insert back, n = " + std::to_string(n)) {
+      TREE* t = prb.erase(PTREE_NODE(&ps[i++ % n].node));
+      prb.insert(t, comparePB);
+      return t;
+    };
+  }
+}
+
+struct IB {
+  ITREE node;
+};
+
+TEST_CASE("itree overlaps", "[bench]") {
+  const size_t n = 1000000;
+  std::mt19937_64 rng(n);
+  std::vector<IB> is(n);
+  intrusive_itree tree;
+  for (auto& i : is) {
+    uint64_t lo = rng() % 1000000000000ull;
+    ITREE_INIT(&i.node, lo, lo + 1 + rng() % 1000000);
+    tree.insert(ITREE_NODE(&i.node));
+  }
+  std::vector<uint64_t> qs(1024);
+  for (auto& q : qs) {
+    q = rng() % 1000000000000ull;
+  }
+
+  size_t i = 0;
+  BENCHMARK("scan with iterate, n = " + std::to_string(n)) {
+    uint64_t a = qs[i++ % qs.size()];
+    size_t k = 0;
+    tree.iterate(TREE_TRAVERSE_INORDER, [&](TREE* t) { k += ITREE_LOW(t) < a + 1000000 && a < ITREE_HIGH(t); });
+    return k;
+  };
+
+  BENCHMARK("iterate_overlaps, n = " + std::to_string(n)) {
+    uint64_t a = qs[i++ % qs.size()];
+    size_t k = 0;
+    tree.iterate_overlaps(a, a + 1000000, [&k](TREE*) { k++; });
+    return k;
+  };
+
+  BENCHMARK("find_overlap, n = " + std::to_string(n)) {
+    uint64_t a = qs[i++ % qs.size()];
+    return tree.find_overlap(a, a + 1000000);
+  };
+}
+
+struct MB {
+  uint64_t deadline;
+  uint64_t bytes;
+  TREE node;
+  uint64_t sum;
+};
+
+#define GETMB(x) TREE_DATA(x, MB, node)
+
+struct MBS {
+  typedef uint64_t type;
+  static type identity() { return 0; }
+  static type combine(type l, type r) { return l + r; }
+  static type value(TREE* t) { return GETMB(t)->bytes; }
+  static type& sum(TREE* t) { return GETMB(t)->sum; }
+};
+
+int orderMB(uint64_t key, TREE* t) { return key < GETMB(t)->deadline ? -1 : (key > GETMB(t)->deadline ? 1 : 0); }
+bool compareMB(TREE* t1, TREE* t2) { return GETMB(t1)->deadline < GETMB(t2)->deadline; }
+
+TEST_CASE("mtree aggregates", "[bench]") {
+  const size_t n = 1000000;
+  std::mt19937_64 rng(n);
+  std::vector<MB> ms(n);
+  intrusive_mtree<MBS> tree;
+  for (auto& m : ms) {
+    m.deadline = rng() % 1000000000;
+    m.bytes = rng() % 65536;
+    tree.insert(&m.node, compareMB);
+  }
+  std::vector<uint64_t> qs(1024);
+  for (auto& q : qs) {
+    q = rng() % 1000000000;
+  }
+
+  // one range in a hundred, about 10000 nodes
+  size_t i = 0;
+  BENCHMARK("sum with iterate_range, n = " + std::to_string(n)) {
+    uint64_t a = qs[i++ % qs.size()];
+    uint64_t k = 0;
+    tree.iterate_range(a, a + 10000000, orderMB, [&k](TREE* t) { k += GETMB(t)->bytes; });
+    return k;
+  };
+
+  BENCHMARK("aggregate, n = " + std::to_string(n)) {
+    uint64_t a = qs[i++ % qs.size()];
+    return tree.aggregate(a, a + 10000000, orderMB);
+  };
+}
+
+TEST_CASE("frozen lookups", "[bench]") {
+  for (size_t n : {10000, 1000000, 8000000}) {
+    std::mt19937_64 rng(n);
+    std::vector<MB> ms(n);
+    intrusive_rbtree tree;
+    for (auto& m : ms) {
+      m.deadline = rng();
+      tree.insert(&m.node, compareMB);
+    }
+    frozen_tree<uint64_t> frozen;
+    frozen.freeze(tree, [](TREE* t) { return GETMB(t)->deadline; });
+    std::vector<uint64_t> qs(4096);
+    for (auto& q : qs) {
+      q = ms[rng() % n].deadline;
+    }
+
+    size_t i = 0;
+    BENCHMARK("rbtree find, n = " + std::to_string(n)) { return tree.find(qs[i++ % qs.size()], orderMB); };
+
+    BENCHMARK("frozen find, n = " + std::to_string(n)) { return frozen.find(qs[i++ % qs.size()]); };
+  }
+}
+
+struct BPB {
+  uint64_t key;
+  PTREE node;
+  BPTREE hook;
+};
+
+int orderBPB(uint64_t key, TREE* t) {
+  uint64_t k = TREE_DATA(t, BPB, node)->key;
+  return key < k ? -1 : (key > k ? 1 : 0);
+}
+
+bool compareBPB(TREE* t1, TREE* t2) { return TREE_DATA(t1, BPB, node)->key < TREE_DATA(t2, BPB, node)->key; }
+
+TEST_CASE("bptree vs binary trees", "[bench]") {
+  for (size_t n : {10000, 1000000, 10000000}) {
+    std::mt19937_64 rng(n);
+    std::vector<BPB> bs(n);
+    intrusive_prbtree prb;
+    intrusive_bptree<uint64_t> bp;
+    for (auto& b : bs) {
+      b.key = rng();
+      prb.insert(PTREE_NODE(&b.node), compareBPB);
+      bp.insert(&b.hook, b.key);
+    }
+    std::vector<uint64_t> qs(4096);
+    for (auto& q : qs) {
+      q = bs[rng() % n].key;
+    }
+
+    size_t i = 0;
+    BENCHMARK("prbtree find, n = " + std::to_string(n)) { return prb.find(qs[i++ % qs.size()], orderBPB); };
+
+    BENCHMARK("bptree find, n = " + std::to_string(n)) { return bp.find(qs[i++ % qs.size()]); };
+
+    BENCHMARK("prbtree erase by node and insert back, n = " + std::to_string(n)) {
+      BPB& b = bs[rng() % n];
+      TREE* t = prb.erase(PTREE_NODE(&b.node));
+      prb.insert(t, compareBPB);
+      return t;
+    };
+
+    BENCHMARK("bptree erase by hook and insert back, n = " + std::to_string(n)) {
+      BPB& b = bs[rng() % n];
+      BPTREE* h = bp.erase(&b.hook);
+      bp.insert(h, b.key);
+      return h;
+    };
+
+    if (n <= 1000000) {
+      BENCHMARK("prbtree iterate, n = " + std::to_string(n)) {
+        uint64_t x = 0;
+        prb.iterate(TREE_TRAVERSE_INORDER, [&x](TREE* t) { x ^= TREE_DATA(t, BPB, node)->key; });
+        return x;
+      };
+
+      BENCHMARK("bptree iterate, n = " + std::to_string(n)) {
+        uint64_t x = 0;
+        bp.iterate([&x](BPTREE* b) { x ^= TREE_DATA(b, BPB, hook)->key; });
+        return x;
+      };
+    }
+  }
+}
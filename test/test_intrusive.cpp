@@ -1,10 +1,35 @@
+#include <algorithm>
 #include <cstdio>
+#include <mutex>
+#include <stdlib.h>
 #include <vector>
 
+// counts the scratch memory the walks ask for
+static size_t tree_mallocs = 0;
+inline void* counted_malloc(size_t n) {
+  tree_mallocs++;
+  return malloc(n);
+}
+#define TREE_MALLOC counted_malloc
+#define TREE_FREE free
+
 #include "catch.hpp"
+#include "intrusive_avltree.h"
+#include "intrusive_bptree.h"
 #include "intrusive_bst.h"
+#include "intrusive_dswtree.h"
+#include "intrusive_frozen.h"
+#include "intrusive_itree.h"
+#include "intrusive_mtree.h"
+#include "intrusive_ostree.h"
+#include "intrusive_prbtree.h"
 #include "intrusive_queue.h"
+#include "intrusive_rbtree.h"
+#include "intrusive_sgtree.h"
 #include "intrusive_slot_queue.h"
+#include "intrusive_splaytree.h"
+#include "intrusive_treap.h"
+#include "intrusive_tree.h"
 
 bool equal(const std::vector<int32_t>& v1, std::vector<int32_t>&& v2) {
   size_t i = 0;
@@ -177,7 +202,8 @@ TEST_CASE("intrusive bst", "[]") {
   REQUIRE(bst.height(max) == 1);
 
   T t1{1}, t30{30};
-  bst.erase(&t1.node, compareT);
+  REQUIRE(bst.erase(&t1.node, compareT) == &ts[2].node);
+  REQUIRE(TREE_EMPTY(&ts[2].node));
   REQUIRE(bst.height() == 3);
   REQUIRE(bst.size() == 5);
   inorder.clear();
@@ -188,13 +214,1943 @@ TEST_CASE("intrusive bst", "[]") {
   bst.iterate(TREE_TRAVERSE_BFS, collect, std::ref(bfs));
   REQUIRE(equal(bfs, {4, 2, 5, 0, 3}));
 
-  bst.erase(&t30.node, compareT);
+  REQUIRE(bst.erase(&t30.node, compareT) == nullptr);
   REQUIRE(bst.size() == 5);
 
+  // two children, the successor 3 takes the place of 2
+  T t2{2};
+  REQUIRE(bst.erase(&t2.node, compareT) == &ts[1].node);
+  bfs.clear();
+  bst.iterate(TREE_TRAVERSE_BFS, collect, std::ref(bfs));
+  REQUIRE(equal(bfs, {4, 3, 5, 0}));
+
+  // the successor 5 is the right child of the root
+  T t4{4};
+  REQUIRE(bst.erase(&t4.node, compareT) == &ts[0].node);
+  bfs.clear();
+  bst.iterate(TREE_TRAVERSE_BFS, collect, std::ref(bfs));
+  REQUIRE(equal(bfs, {5, 3, 0}));
+
+  for (int32_t i : {3, 0, 5}) {
+    T x{i};
+    REQUIRE(bst.erase(&x.node, compareT) != nullptr);
+  }
+  REQUIRE(bst.empty());
+
+  for (auto& t : ts) {
+    bst.insert(&t.node, compareT);
+  }
+  REQUIRE(bst.size() == 6);
   bst.clear();
   REQUIRE(bst.empty());
 }
 
+int compareKey(int32_t k, TREE* t) { return k < GETT(t)->v ? -1 : (k > GETT(t)->v ? 1 : 0); }
+
+TEST_CASE("intrusive bst lookup", "[]") {
+  T ts[] = {{4}, {2}, {6}, {2}, {0}, {8}, {6}, {6}};
+  intrusive_bst bst;
+  REQUIRE(bst.find(1, compareKey) == nullptr);
+  REQUIRE(bst.lower_bound(1, compareKey) == nullptr);
+
+  for (auto& t : ts) {
+    bst.insert(&t.node, compareT);
+  }
+
+  REQUIRE(bst.find(4, compareKey) == &ts[0].node);
+  REQUIRE(GETT(bst.find(6, compareKey))->v == 6);
+  REQUIRE(bst.find(5, compareKey) == nullptr);
+  REQUIRE(bst.find(9, compareKey) == nullptr);
+
+  REQUIRE(bst.lower_bound(-1, compareKey) == &ts[4].node);
+  REQUIRE(bst.lower_bound(2, compareKey) == &ts[1].node);
+  REQUIRE(bst.lower_bound(3, compareKey) == &ts[0].node);
+  REQUIRE(bst.lower_bound(6, compareKey) == &ts[2].node);
+  REQUIRE(bst.lower_bound(9, compareKey) == nullptr);
+
+  REQUIRE(bst.upper_bound(2, compareKey) == &ts[0].node);
+  REQUIRE(bst.upper_bound(6, compareKey) == &ts[5].node);
+  REQUIRE(bst.upper_bound(8, compareKey) == nullptr);
+
+  auto r = bst.equal_range(6, compareKey);
+  REQUIRE(r.first == &ts[2].node);
+  REQUIRE(r.second == &ts[5].node);
+  std::vector<int32_t> in;
+  bool inside = false;
+  bst.iterate(TREE_TRAVERSE_INORDER, [&](TREE* t) {
+    inside = (inside || t == r.first) && t != r.second;
+    if (inside) {
+      in.push_back(GETT(t)->v);
+    }
+  });
+  REQUIRE(equal(in, {6, 6, 6}));
+
+  r = bst.equal_range(2, compareKey);
+  REQUIRE(r.first == &ts[1].node);
+  REQUIRE(r.second == &ts[0].node);
+  r = bst.equal_range(5, compareKey);
+  REQUIRE(r.first == &ts[2].node);
+  REQUIRE(r.second == &ts[2].node);
+  r = bst.equal_range(8, compareKey);
+  REQUIRE(r.first == &ts[5].node);
+  REQUIRE(r.second == nullptr);
+
+  // the same lookups on a balanced tree, a lambda as comparator
+  intrusive_rbtree rb;
+  for (auto& t : ts) {
+    rb.insert(&t.node, compareT);
+  }
+  auto compare = [](int32_t k, TREE* t) { return compareKey(k, t); };
+  REQUIRE(rb.find(4, compare) == &ts[0].node);
+  REQUIRE(GETT(rb.lower_bound(5, compare))->v == 6);
+  REQUIRE(GETT(rb.upper_bound(6, compare))->v == 8);
+  r = rb.equal_range(2, compare);
+  REQUIRE(GETT(r.first)->v == 2);
+  REQUIRE(GETT(r.second)->v == 4);
+}
+
+TEST_CASE("intrusive bst early exit", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_bst bst;
+  for (auto& t : ts) {
+    bst.insert(&t.node, compareT);
+  }
+
+  // the first n in each order
+  auto first = [](TREE* t, std::vector<int32_t>& v, size_t n) {
+    v.push_back(GETT(t)->v);
+    return v.size() < n;
+  };
+
+  std::vector<int32_t> preorder;
+  bst.iterate(TREE_TRAVERSE_PREORDER, first, std::ref(preorder), 3);
+  REQUIRE(equal(preorder, {4, 2, 1}));
+
+  std::vector<int32_t> inorder;
+  bst.iterate(TREE_TRAVERSE_INORDER, first, std::ref(inorder), 2);
+  REQUIRE(equal(inorder, {0, 1}));
+
+  std::vector<int32_t> postorder;
+  bst.iterate(TREE_TRAVERSE_POSTORDER, first, std::ref(postorder), 4);
+  REQUIRE(equal(postorder, {0, 1, 3, 2}));
+
+  std::vector<int32_t> bfs;
+  bst.iterate(TREE_TRAVERSE_BFS, first, std::ref(bfs), 1);
+  REQUIRE(equal(bfs, {4}));
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+
+  std::vector<int32_t> range;
+  bst.iterate_range(1, 4, compareKey, collect, std::ref(range));
+  REQUIRE(equal(range, {1, 2, 3}));
+  range.clear();
+  bst.iterate_range(-5, 100, compareKey, collect, std::ref(range));
+  REQUIRE(equal(range, {0, 1, 2, 3, 4, 5}));
+  range.clear();
+  bst.iterate_range(3, 3, compareKey, collect, std::ref(range));
+  REQUIRE(range.empty());
+  bst.iterate_range(2, 100, compareKey, first, std::ref(range), 2);
+  REQUIRE(equal(range, {2, 3}));
+
+  // only the path to the range and the range itself are visited
+  std::vector<T> vs;
+  vs.reserve(1023);
+  for (int32_t i = 0; i < 1023; i++) {
+    vs.emplace_back(i);
+  }
+  intrusive_rbtree rb;
+  for (auto& t : vs) {
+    rb.insert(&t.node, compareT);
+  }
+  size_t compared = 0;
+  auto counting = [&compared](int32_t k, TREE* t) {
+    compared++;
+    return compareKey(k, t);
+  };
+  range.clear();
+  rb.iterate_range(500, 505, counting, collect, std::ref(range));
+  REQUIRE(equal(range, {500, 501, 502, 503, 504}));
+  REQUIRE(compared < 2 * rb.height() + 2 * range.size());
+}
+
+TEST_CASE("intrusive bst bfs", "[]") {
+  std::vector<T> vs;
+  vs.reserve(1000);
+  for (int32_t i = 0; i < 1000; i++) {
+    vs.emplace_back(i * 7 % 1000);
+  }
+  intrusive_bst bst;
+  for (auto& t : vs) {
+    bst.insert(&t.node, compareT);
+  }
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+
+  std::vector<int32_t> bfs;
+  bst.iterate(TREE_TRAVERSE_BFS, collect, std::ref(bfs));
+  REQUIRE(bfs.size() == 1000);
+
+  // rings too narrow for the widest levels fall back to depth limited descents at some level, which stop short of
+  // levels TREE_STACK_INLINE deep
+  REQUIRE(bst.height() > TREE_STACK_INLINE);
+  for (size_t capacity : {1, 2, 5, 16, 64, 500}) {
+    std::vector<TREE*> ring(capacity);
+    std::vector<int32_t> levels;
+    bool whole = bst.iterate_bfs_ring(ring.data(), capacity, collect, bst.root, std::ref(levels));
+    REQUIRE(std::equal(levels.begin(), levels.end(), bfs.begin()));
+    REQUIRE(whole == (levels.size() == bfs.size()));
+    REQUIRE(whole == (capacity >= 16));
+  }
+
+  std::vector<int32_t> levels;
+  bst.iterate_levels(0, collect, bst.root, std::ref(levels));
+  REQUIRE(levels == bfs);
+
+  size_t count = 0;
+  bst.iterate_levels(0, [&count](TREE* t) { return ++count < 10; }, bst.root);
+  REQUIRE(count == 10);
+
+  // a ring or the levels never allocate, iterate_bfs only does for a level wider than half its inline ring
+  size_t before = tree_mallocs;
+  std::vector<TREE*> two(2);
+  levels.clear();
+  bst.iterate_bfs_ring(two.data(), two.size(), collect, bst.root, std::ref(levels));
+  levels.clear();
+  bst.iterate_levels(0, collect, bst.root, std::ref(levels));
+  REQUIRE(levels == bfs);
+  REQUIRE(tree_mallocs == before);
+  intrusive_bst wide;
+  std::vector<TREE*> sorted;
+  bst.iterate(TREE_TRAVERSE_INORDER, [&sorted](TREE* t) { sorted.push_back(t); });
+  wide.build(sorted.begin(), sorted.size(), [](TREE* t) { return t; });
+  before = tree_mallocs;
+  wide.iterate(TREE_TRAVERSE_BFS, [](TREE*) {});
+  REQUIRE(tree_mallocs - before == 1);
+  before = tree_mallocs;
+  wide.iterate_bfs_ring(two.data(), two.size(), [](TREE*) {}, wide.root);
+  REQUIRE(tree_mallocs == before);
+
+  // a caterpillar deeper than the inline stack, a small ring stops short of its lower levels while iterate_levels
+  // walks them with threads
+  std::vector<T> cs;
+  cs.reserve(400);
+  intrusive_bst deep;
+  for (int32_t i = 0; i < 400; i++) {
+    cs.emplace_back(i < 200 ? 2 * i : 2 * (i - 200) + 1);
+    deep.insert(&cs.back().node, compareT);
+  }
+  std::vector<int32_t> dbfs;
+  deep.iterate(TREE_TRAVERSE_BFS, collect, std::ref(dbfs));
+  REQUIRE(dbfs.size() == 400);
+  before = tree_mallocs;
+  levels.clear();
+  REQUIRE(!deep.iterate_bfs_ring(two.data(), two.size(), collect, deep.root, std::ref(levels)));
+  REQUIRE(levels.size() == 2 * TREE_STACK_INLINE - 2); // one node on the first two levels, two on the others
+  REQUIRE(std::equal(levels.begin(), levels.end(), dbfs.begin()));
+  std::vector<TREE*> half(200);
+  levels.clear();
+  REQUIRE(deep.iterate_bfs_ring(half.data(), half.size(), collect, deep.root, std::ref(levels)));
+  REQUIRE(levels == dbfs);
+  levels.clear();
+  deep.iterate_levels(0, collect, deep.root, std::ref(levels));
+  REQUIRE(levels == dbfs);
+  REQUIRE(tree_mallocs == before);
+
+  // the ring leaves the tree as it is for f to read
+  bool intact = true;
+  deep.iterate_bfs_ring(two.data(), two.size(), [&](TREE*) { intact = intact && deep.size() == 400; }, deep.root);
+  REQUIRE(intact);
+
+  // stopping halfway down still undoes every thread
+  count = 0;
+  deep.iterate_levels(100, [&count](TREE* t) { return ++count < 3; }, deep.root);
+  REQUIRE(count == 3);
+  levels.clear();
+  deep.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(levels));
+  REQUIRE(levels.size() == 400);
+  REQUIRE(std::is_sorted(levels.begin(), levels.end()));
+  levels.clear();
+  deep.iterate(TREE_TRAVERSE_BFS, collect, std::ref(levels));
+  REQUIRE(levels == dbfs);
+}
+
+TEST_CASE("intrusive bst iterator", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_bst bst;
+  REQUIRE(bst.begin() == bst.end());
+  REQUIRE(*--bst.end() == nullptr);
+
+  for (auto& t : ts) {
+    bst.insert(&t.node, compareT);
+  }
+
+  std::vector<int32_t> v1;
+  for (auto it = bst.begin(); it != bst.end(); it++) {
+    v1.push_back(GETT(*it)->v);
+  }
+  REQUIRE(equal(v1, {0, 1, 2, 3, 4, 5}));
+
+  std::vector<int32_t> v2;
+  for (auto it = bst.end(); it != bst.begin();) {
+    v2.push_back(GETT(*--it)->v);
+  }
+  REQUIRE(equal(v2, {5, 4, 3, 2, 1, 0}));
+
+  // a scan from lower_bound, interrupted and resumed
+  auto it = bst.begin(2, compareKey);
+  std::vector<int32_t> v3;
+  v3.push_back(GETT(*it++)->v);
+  auto resume = it;
+  while (resume != bst.end()) {
+    v3.push_back(GETT(*resume)->v);
+    ++resume;
+  }
+  REQUIRE(equal(v3, {2, 3, 4, 5}));
+  REQUIRE(GETT(*it)->v == 3);
+  REQUIRE(bst.begin(6, compareKey) == bst.end());
+  REQUIRE(sizeof(it++) == sizeof(TREE*));
+
+  REQUIRE(GETT(bst.next(&ts[2].node, compareT))->v == 2);
+  REQUIRE(GETT(bst.next(&ts[3].node, compareT))->v == 4);
+  REQUIRE(bst.next(&ts[5].node, compareT) == nullptr);
+  REQUIRE(GETT(bst.prev(&ts[0].node, compareT))->v == 3);
+  REQUIRE(GETT(bst.prev(&ts[3].node, compareT))->v == 2);
+  REQUIRE(bst.prev(&ts[4].node, compareT) == nullptr);
+
+  // a chain deeper than the inline path, stepping and next or prev take no heap past begin()
+  std::vector<T> chain;
+  chain.reserve(200);
+  intrusive_bst deep;
+  for (int32_t i = 0; i < 200; i++) {
+    chain.emplace_back(199 - i);
+    deep.insert(&chain[i].node, compareT);
+  }
+  auto d = deep.begin();
+  size_t before = tree_mallocs;
+  int32_t expect = 0;
+  bool stepped = true;
+  while (d != deep.end()) {
+    stepped = stepped && GETT(*d++)->v == expect++;
+  }
+  for (int32_t i = 0; i < 200; i++) {
+    TREE* t = &chain[199 - i].node;
+    stepped = stepped && deep.next(t, compareT) == (i < 199 ? &chain[198 - i].node : nullptr);
+    stepped = stepped && deep.prev(t, compareT) == (i > 0 ? &chain[200 - i].node : nullptr);
+  }
+  REQUIRE(stepped);
+  REQUIRE(expect == 200);
+  REQUIRE(tree_mallocs == before);
+
+  // equal keys on a balanced tree, next and prev still follow the nodes themselves
+  std::vector<T> vs;
+  vs.reserve(64);
+  for (int32_t i = 0; i < 64; i++) {
+    vs.emplace_back(i / 4);
+  }
+  intrusive_rbtree rb;
+  for (auto& t : vs) {
+    rb.insert(&t.node, compareT);
+  }
+  std::vector<TREE*> order;
+  for (auto i = rb.begin(); i != rb.end(); ++i) {
+    order.push_back(*i);
+  }
+  REQUIRE(order.size() == 64);
+  bool linked = true;
+  for (size_t i = 0; i < order.size(); i++) {
+    linked = linked && rb.next(order[i], compareT) == (i + 1 < order.size() ? order[i + 1] : nullptr);
+    linked = linked && rb.prev(order[i], compareT) == (i > 0 ? order[i - 1] : nullptr);
+    linked = linked && *rb.iterator_to(order[i], compareT) == order[i];
+  }
+  REQUIRE(linked);
+  T x{3};
+  REQUIRE(rb.iterator_to(&x.node, compareT) == rb.end());
+}
+
+// orders T by v, and against plain keys for lookups
+struct lessT {
+  bool operator()(const T& t1, const T& t2) const { return t1.v < t2.v; }
+  bool operator()(int32_t k, const T& t) const { return k < t.v; }
+  bool operator()(const T& t, int32_t k) const { return t.v < k; }
+};
+
+TEST_CASE("intrusive tree", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_tree<TREE_MEMBER(T, node), lessT> tree;
+  REQUIRE(tree.empty());
+  REQUIRE(tree.min() == nullptr);
+
+  for (auto& t : ts) {
+    tree.insert(&t);
+  }
+  REQUIRE(tree.size() == 6);
+  REQUIRE(tree.height() == 4);
+  REQUIRE(tree.min() == &ts[4]);
+  REQUIRE(tree.max() == &ts[5]);
+  REQUIRE(decltype(tree)::data(&ts[1].node) == &ts[1]);
+
+  std::vector<int32_t> preorder;
+  tree.iterate(TREE_TRAVERSE_PREORDER, [](T* t, std::vector<int32_t>& v) { v.push_back(t->v); }, std::ref(preorder));
+  REQUIRE(equal(preorder, {4, 2, 1, 0, 3, 5}));
+
+  REQUIRE(tree.find(3) == &ts[3]);
+  REQUIRE(tree.find(ts[0]) == &ts[0]);
+  REQUIRE(tree.find(7) == nullptr);
+  REQUIRE(tree.lower_bound(6) == nullptr);
+  REQUIRE(tree.upper_bound(1) == &ts[1]);
+  auto r = tree.equal_range(2);
+  REQUIRE(r.first == &ts[1]);
+  REQUIRE(r.second == &ts[3]);
+
+  T t1{1};
+  REQUIRE(tree.erase(&t1) == &ts[2]);
+  REQUIRE(tree.erase(&t1) == nullptr);
+  REQUIRE(tree.size() == 5);
+
+  // the same view over a red-black tree, std::less by default
+  struct U {
+    int32_t v;
+    TREE link;
+    bool operator<(const U& u) const { return v < u.v; }
+  };
+  std::vector<U> us(100);
+  intrusive_tree<TREE_MEMBER(U, link), std::less<U>, intrusive_rbtree> rb;
+  for (int32_t i = 0; i < 100; i++) {
+    us[i].v = i;
+    rb.insert(&us[i]);
+  }
+  REQUIRE(rb.size() == 100);
+  REQUIRE(rb.height() <= 13);
+  REQUIRE(rb.find(us[42]) == &us[42]);
+  REQUIRE(rb.erase(&us[0]) == &us[0]);
+  REQUIRE(rb.min() == &us[1]);
+  REQUIRE(decltype(rb)::node(&us[7]) == &us[7].link);
+
+  // a member past padding, well in from the start
+  struct W {
+    char c;
+    double d;
+    TREE node;
+    int32_t v;
+    bool operator<(const W& w) const { return v < w.v; }
+  };
+  std::vector<W> ws(10);
+  intrusive_tree<TREE_MEMBER(W, node), std::less<W>> wt;
+  for (int32_t i = 0; i < 10; i++) {
+    ws[i].v = 9 - i;
+    wt.insert(&ws[i]);
+  }
+  REQUIRE(decltype(wt)::data(&ws[3].node) == &ws[3]);
+  REQUIRE(wt.min() == &ws[9]);
+  REQUIRE(wt.find(ws[4]) == &ws[4]);
+}
+
+TEST_CASE("intrusive bst deep", "[]") {
+  // degenerate chains far deeper than any call stack would take
+  const int32_t n = 1000000;
+  std::vector<T> vs;
+  vs.reserve(n);
+  for (int32_t i = 0; i < n; i++) {
+    vs.emplace_back(i);
+  }
+
+  for (int dir : {0, 1}) {
+    for (auto& t : vs) {
+      TREE_INIT(&t.node);
+    }
+    intrusive_bst bst;
+    bst.root = &vs[dir ? 0 : n - 1].node;
+    for (int32_t i = 1; i < n; i++) {
+      T& p = vs[dir ? i - 1 : n - i];
+      T& c = vs[dir ? i : n - i - 1];
+      intrusive_bst::link(&p.node, dir, &c.node);
+    }
+    REQUIRE(bst.height() == size_t(n));
+    REQUIRE(bst.size() == size_t(n));
+
+    int32_t next = 0;
+    bool sorted = true;
+    bst.iterate(TREE_TRAVERSE_INORDER, [&next, &sorted](TREE* t) { sorted = sorted && GETT(t)->v == next++; });
+    REQUIRE(sorted);
+
+    next = 0;
+    bst.iterate_morris([&next, &sorted](TREE* t) { sorted = sorted && GETT(t)->v == next++; }, bst.root);
+    REQUIRE(sorted);
+    REQUIRE(next == n);
+
+    size_t count = 0;
+    bst.iterate(TREE_TRAVERSE_PREORDER, [&count](TREE* t) { count++; });
+    bst.iterate(TREE_TRAVERSE_POSTORDER, [&count](TREE* t) { count++; });
+    REQUIRE(count == 2 * size_t(n));
+
+    T x{n};
+    bst.insert(&x.node, compareT);
+    REQUIRE(bst.max(bst.root) == &x.node);
+    REQUIRE(bst.erase(&x.node, compareT) == &x.node);
+    T y{0};
+    REQUIRE(bst.erase(&y.node, compareT) == &vs[0].node);
+    REQUIRE(bst.size() == size_t(n - 1));
+
+    bst.root = intrusive_bst::balance(bst.root);
+    REQUIRE(bst.height() == 20);
+    next = 1;
+    bst.iterate(TREE_TRAVERSE_INORDER, [&next, &sorted](TREE* t) { sorted = sorted && GETT(t)->v == next++; });
+    REQUIRE(sorted);
+  }
+}
+
+// black height of t, 0 if the red-black rules are broken below t
+size_t black_height(TREE* t) {
+  if (t == nullptr) {
+    return 1;
+  }
+  TREE* l = intrusive_bst::child(t, 0);
+  TREE* r = intrusive_bst::child(t, 1);
+  if (RBTREE_RED(t) && ((l != nullptr && RBTREE_RED(l)) || (r != nullptr && RBTREE_RED(r)))) {
+    return 0;
+  }
+  size_t hl = black_height(l);
+  size_t hr = black_height(r);
+  if (hl == 0 || hl != hr) {
+    return 0;
+  }
+  return hl + (RBTREE_RED(t) ? 0 : 1);
+}
+
+TEST_CASE("intrusive rbtree", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_rbtree rb;
+  REQUIRE(rb.empty());
+
+  for (auto& t : ts) {
+    rb.insert(&t.node, compareT);
+  }
+  REQUIRE(rb.size() == 6);
+  REQUIRE(rb.height() == 3);
+  REQUIRE(!RBTREE_RED(rb.root));
+  REQUIRE(black_height(rb.root) > 0);
+  REQUIRE(sizeof(TREE) == 2 * sizeof(void*));
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+
+  std::vector<int32_t> inorder;
+  rb.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 1, 2, 3, 4, 5}));
+  REQUIRE(GETT(rb.min(rb.root))->v == 0);
+  REQUIRE(GETT(rb.max(rb.root))->v == 5);
+
+  T t1{1}, t30{30};
+  REQUIRE(rb.erase(&t1.node, compareT) == &ts[2].node);
+  REQUIRE(TREE_EMPTY(&ts[2].node));
+  REQUIRE(rb.erase(&t30.node, compareT) == nullptr);
+  REQUIRE(rb.size() == 5);
+  REQUIRE(black_height(rb.root) > 0);
+  inorder.clear();
+  rb.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 2, 3, 4, 5}));
+
+  // monotone keys keep the height logarithmic
+  std::vector<T> vs;
+  vs.reserve(1024);
+  for (int32_t i = 0; i < 1024; i++) {
+    vs.emplace_back(i);
+  }
+  intrusive_rbtree rb2;
+  for (auto& t : vs) {
+    rb2.insert(&t.node, compareT);
+  }
+  REQUIRE(rb2.size() == 1024);
+  REQUIRE(rb2.height() <= 20);
+  REQUIRE(black_height(rb2.root) > 0);
+
+  for (int32_t i = 0; i < 1024; i += 2) {
+    T x{i};
+    REQUIRE(rb2.erase(&x.node, compareT) == &vs[i].node);
+    REQUIRE(black_height(rb2.root) > 0);
+  }
+  REQUIRE(rb2.size() == 512);
+  REQUIRE(rb2.height() <= 18);
+  inorder.clear();
+  rb2.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(inorder.size() == 512);
+  for (size_t i = 0; i < inorder.size(); i++) {
+    REQUIRE(inorder[i] == int32_t(2 * i + 1));
+  }
+
+  for (int32_t i = 1; i < 1024; i += 2) {
+    T x{i};
+    REQUIRE(rb2.erase(&x.node, compareT) == &vs[i].node);
+  }
+  REQUIRE(rb2.empty());
+}
+
+// one more than the height of t, 0 if the balance tags below t are wrong or off by more than one
+size_t avl_height(TREE* t) {
+  if (t == nullptr) {
+    return 1;
+  }
+  size_t hl = avl_height(intrusive_bst::child(t, 0));
+  size_t hr = avl_height(intrusive_bst::child(t, 1));
+  if (hl == 0 || hr == 0 || (TREE_TAG(TREE_LEFT(t)) && TREE_TAG(TREE_RIGHT(t))) ||
+      (int)hr - (int)hl != AVLTREE_BALANCE(t)) {
+    return 0;
+  }
+  return 1 + (hl > hr ? hl : hr);
+}
+
+TEST_CASE("intrusive avltree", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_avltree avl;
+  REQUIRE(avl.empty());
+  REQUIRE(avl.height() == 0);
+
+  for (auto& t : ts) {
+    avl.insert(&t.node, compareT);
+  }
+  REQUIRE(avl.size() == 6);
+  REQUIRE(avl.height() == 3);
+  REQUIRE(avl_height(avl.root) == 4);
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+
+  std::vector<int32_t> inorder;
+  avl.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 1, 2, 3, 4, 5}));
+
+  T t1{1}, t30{30};
+  REQUIRE(avl.erase(&t1.node, compareT) == &ts[2].node);
+  REQUIRE(TREE_EMPTY(&ts[2].node));
+  REQUIRE(avl.erase(&t30.node, compareT) == nullptr);
+  REQUIRE(avl.size() == 5);
+  REQUIRE(avl_height(avl.root) == avl.height() + 1);
+
+  // monotone keys, a perfect tree once all 1023 are in
+  std::vector<T> vs;
+  vs.reserve(1023);
+  for (int32_t i = 0; i < 1023; i++) {
+    vs.emplace_back(i);
+  }
+  intrusive_avltree avl2;
+  for (auto& t : vs) {
+    avl2.insert(&t.node, compareT);
+    REQUIRE(avl_height(avl2.root) == avl2.height() + 1);
+  }
+  REQUIRE(avl2.height() == 10);
+  REQUIRE(avl2.height(avl2.root) == 10);
+
+  for (int32_t i = 0; i < 1023; i += 2) {
+    T x{i};
+    REQUIRE(avl2.erase(&x.node, compareT) == &vs[i].node);
+    REQUIRE(avl_height(avl2.root) == avl2.height() + 1);
+  }
+  REQUIRE(avl2.size() == 511);
+  inorder.clear();
+  avl2.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(inorder.size() == 511);
+  for (size_t i = 0; i < inorder.size(); i++) {
+    REQUIRE(inorder[i] == int32_t(2 * i + 1));
+  }
+
+  for (int32_t i = 1; i < 1023; i += 2) {
+    T x{i};
+    REQUIRE(avl2.erase(&x.node, compareT) == &vs[i].node);
+  }
+  REQUIRE(avl2.empty());
+  REQUIRE(avl2.height() == 0);
+
+  intrusive_tree<TREE_MEMBER(T, node), lessT, intrusive_avltree> tree;
+  for (auto& t : vs) {
+    tree.insert(&t);
+  }
+  REQUIRE(tree.height() == 10);
+  REQUIRE(tree.find(700) == &vs[700]);
+}
+
+TEST_CASE("intrusive sgtree", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_sgtree sg;
+  REQUIRE(sg.empty());
+  for (auto& t : ts) {
+    sg.insert(&t.node, compareT);
+  }
+  REQUIRE(sg.size() == 6);
+  REQUIRE(sizeof(ts[0].node) == 2 * sizeof(void*));
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+  std::vector<int32_t> inorder;
+  sg.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 1, 2, 3, 4, 5}));
+
+  T t1{1}, t30{30};
+  REQUIRE(sg.erase(&t1.node, compareT) == &ts[2].node);
+  REQUIRE(TREE_EMPTY(&ts[2].node));
+  REQUIRE(sg.erase(&t30.node, compareT) == nullptr);
+  REQUIRE(sg.size() == 5);
+
+  // monotone keys, every insert lands at the bottom of the right spine, log1.5(1024) is about 17
+  std::vector<T> vs;
+  vs.reserve(1024);
+  for (int32_t i = 0; i < 1024; i++) {
+    vs.emplace_back(i);
+  }
+  intrusive_sgtree sg2;
+  for (auto& t : vs) {
+    sg2.insert(&t.node, compareT);
+    REQUIRE(sg2.height() <= 18);
+  }
+  REQUIRE(sg2.size() == 1024);
+
+  // erasing a third of the nodes rebuilds the whole tree
+  for (int32_t i = 0; i < 342; i++) {
+    T x{i * 3};
+    REQUIRE(sg2.erase(&x.node, compareT) == &vs[i * 3].node);
+  }
+  REQUIRE(sg2.size() == 682);
+  REQUIRE(sg2.height() == 10);
+  inorder.clear();
+  sg2.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(inorder.size() == 682);
+  REQUIRE(inorder[0] == 1);
+  REQUIRE(inorder[681] == 1022);
+
+  sg2.clear();
+  REQUIRE(sg2.empty());
+  REQUIRE(sg2.size() == 0);
+}
+
+TEST_CASE("intrusive dswtree", "[]") {
+  std::vector<T> vs;
+  vs.reserve(1023);
+  for (int32_t i = 0; i < 1023; i++) {
+    vs.emplace_back(i);
+  }
+
+  intrusive_bst bst;
+  for (auto& t : vs) {
+    bst.insert(&t.node, compareT);
+  }
+  REQUIRE(bst.height() == 1023);
+  bst.rebalance();
+  REQUIRE(bst.height() == 10);
+  REQUIRE(bst.size() == 1023);
+  int32_t next = 0;
+  bool sorted = true;
+  bst.iterate(TREE_TRAVERSE_INORDER, [&next, &sorted](TREE* t) { sorted = sorted && GETT(t)->v == next++; });
+  REQUIRE(sorted);
+
+  // no trigger, a list until asked
+  intrusive_dswtree list(0);
+  for (auto& t : vs) {
+    list.insert(&t.node, compareT);
+  }
+  REQUIRE(list.size() == 1023);
+  REQUIRE(list.height() == 1023);
+  list.rebalance();
+  REQUIRE(list.height() == 10);
+
+  // a left spine 1001 deep with a right leaf on each node, rebalanced without the heap
+  std::vector<T> ws;
+  ws.reserve(2002);
+  for (int32_t i = 0; i < 2002; i++) {
+    ws.emplace_back(i);
+  }
+  intrusive_bst deep;
+  for (int32_t i = 1000; i >= 0; i--) {
+    deep.insert(&ws[2 * i + 1].node, compareT);
+    if (i < 1000) {
+      deep.insert(&ws[2 * i + 2].node, compareT);
+    }
+  }
+  deep.insert(&ws[0].node, compareT);
+  REQUIRE(deep.height() == 1002);
+  size_t before = tree_mallocs;
+  deep.rebalance();
+  REQUIRE(tree_mallocs == before);
+  REQUIRE(deep.height() == 11);
+  REQUIRE(deep.size() == 2002);
+  next = 0;
+  deep.iterate(TREE_TRAVERSE_INORDER, [&next, &sorted](TREE* t) { sorted = sorted && GETT(t)->v == next++; });
+  REQUIRE(sorted);
+
+  // ascending keys stay within twice log2(n) all along
+  intrusive_dswtree dsw;
+  bool shallow = true;
+  for (size_t i = 0; i < vs.size(); i++) {
+    dsw.insert(&vs[i].node, compareT);
+    shallow = shallow && double(dsw.height()) <= 2 * log2(double(i + 1)) + 1;
+  }
+  REQUIRE(shallow);
+  REQUIRE(dsw.size() == 1023);
+  next = 0;
+  dsw.iterate(TREE_TRAVERSE_INORDER, [&next, &sorted](TREE* t) { sorted = sorted && GETT(t)->v == next++; });
+  REQUIRE(sorted);
+
+  for (int32_t i = 0; i < 1023; i += 2) {
+    T x{i};
+    REQUIRE(dsw.erase(&x.node, compareT) == &vs[i].node);
+  }
+  REQUIRE(dsw.size() == 511);
+  dsw.clear();
+  REQUIRE(dsw.empty());
+  REQUIRE(dsw.size() == 0);
+}
+
+TEST_CASE("intrusive splaytree", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_splaytree sp;
+  REQUIRE(sp.find(1, compareKey) == nullptr);
+  for (auto& t : ts) {
+    sp.insert(&t.node, compareT);
+    REQUIRE(sp.root == &t.node);
+  }
+  REQUIRE(sp.size() == 6);
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+  std::vector<int32_t> inorder;
+  sp.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 1, 2, 3, 4, 5}));
+
+  REQUIRE(sp.find(3, compareKey) == &ts[3].node);
+  REQUIRE(sp.root == &ts[3].node);
+  REQUIRE(sp.find(7, compareKey) == nullptr);
+  REQUIRE(sp.root == &ts[5].node);
+
+  T t1{1}, t30{30};
+  REQUIRE(sp.erase(&t1.node, compareT) == &ts[2].node);
+  REQUIRE(TREE_EMPTY(&ts[2].node));
+  REQUIRE(sp.erase(&t30.node, compareT) == nullptr);
+  REQUIRE(sp.size() == 5);
+  inorder.clear();
+  sp.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 2, 3, 4, 5}));
+
+  // ascending keys make a left spine, one find at the bottom roughly halves it
+  const int32_t n = 100000;
+  std::vector<T> vs;
+  vs.reserve(n);
+  for (int32_t i = 0; i < n; i++) {
+    vs.emplace_back(i);
+  }
+  intrusive_splaytree sp2;
+  for (auto& t : vs) {
+    sp2.insert(&t.node, compareT);
+  }
+  REQUIRE(sp2.height() == size_t(n));
+  REQUIRE(sp2.find(0, compareKey) == &vs[0].node);
+  REQUIRE(sp2.height() <= size_t(n / 2 + 2));
+  REQUIRE(sp2.size() == size_t(n));
+
+  // two hot keys alternate at the top
+  for (int32_t i = 0; i < 100; i++) {
+    REQUIRE(sp2.find(i % 2 ? 777 : 778, compareKey) != nullptr);
+  }
+  REQUIRE(sp2.root == &vs[777].node);
+  REQUIRE(intrusive_bst::child(sp2.root, 1) == &vs[778].node);
+
+  for (int32_t i = 0; i < n; i++) {
+    T x{i};
+    REQUIRE(sp2.erase(&x.node, compareT) == &vs[i].node);
+  }
+  REQUIRE(sp2.empty());
+}
+
+// every child below t ranks under its parent
+bool heap_ordered(TREE* t) {
+  if (t == nullptr) {
+    return true;
+  }
+  for (int dir : {0, 1}) {
+    TREE* c = intrusive_bst::child(t, dir);
+    if (c != nullptr && (intrusive_treap::priority(c) > intrusive_treap::priority(t) || !heap_ordered(c))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_CASE("intrusive treap", "[]") {
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  intrusive_treap tp;
+  REQUIRE(tp.empty());
+  for (auto& t : ts) {
+    tp.insert(&t.node, compareT);
+  }
+  REQUIRE(tp.size() == 6);
+  REQUIRE(heap_ordered(tp.root));
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+  std::vector<int32_t> inorder;
+  tp.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 1, 2, 3, 4, 5}));
+
+  T t1{1}, t30{30};
+  REQUIRE(tp.erase(&t1.node, compareT) == &ts[2].node);
+  REQUIRE(TREE_EMPTY(&ts[2].node));
+  REQUIRE(tp.erase(&t30.node, compareT) == nullptr);
+  REQUIRE(heap_ordered(tp.root));
+  inorder.clear();
+  tp.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  REQUIRE(equal(inorder, {0, 2, 3, 4, 5}));
+
+  // monotone and equal keys, the shape only depends on the addresses
+  std::vector<T> vs;
+  vs.reserve(1024);
+  for (int32_t i = 0; i < 1024; i++) {
+    vs.emplace_back(i / 2);
+  }
+  intrusive_treap tp2;
+  for (auto& t : vs) {
+    tp2.insert(&t.node, compareT);
+  }
+  REQUIRE(tp2.size() == 1024);
+  REQUIRE(tp2.height() <= 50);
+  REQUIRE(heap_ordered(tp2.root));
+  std::vector<TREE*> order;
+  tp2.iterate(TREE_TRAVERSE_INORDER, [&order](TREE* t) { order.push_back(t); });
+  bool stable = true;
+  for (size_t i = 0; i < order.size(); i++) {
+    stable = stable && order[i] == &vs[i].node;
+  }
+  REQUIRE(stable);
+
+  for (int32_t i = 0; i < 1024; i++) {
+    T x{i / 2};
+    REQUIRE(tp2.erase(&x.node, compareT) != nullptr);
+    REQUIRE((i % 64 != 0 || heap_ordered(tp2.root)));
+  }
+  REQUIRE(tp2.empty());
+}
+
+TEST_CASE("intrusive treap split", "[]") {
+  std::vector<T> vs;
+  vs.reserve(1000);
+  for (int32_t i = 0; i < 1000; i++) {
+    vs.emplace_back(i * 7 % 1000 / 2);
+  }
+  intrusive_treap tp;
+  for (auto& t : vs) {
+    tp.insert(&t.node, compareT);
+  }
+  std::vector<TREE*> all;
+  tp.iterate(TREE_TRAVERSE_INORDER, [&all](TREE* t) { all.push_back(t); });
+
+  auto nodes = [](const intrusive_treap& t) {
+    std::vector<TREE*> v;
+    if (!t.empty()) {
+      t.iterate_inorder([&v](TREE* x) { v.push_back(x); }, t.root);
+    }
+    return v;
+  };
+
+  // cut anywhere, at equal keys too, and glue back
+  for (int32_t key : {-1, 0, 1, 250, 251, 499, 500}) {
+    intrusive_treap right;
+    tp.split(key, compareKey, right);
+    REQUIRE(heap_ordered(tp.root));
+    REQUIRE(heap_ordered(right.root));
+    std::vector<TREE*> l = nodes(tp);
+    std::vector<TREE*> r = nodes(right);
+    REQUIRE(l.size() + r.size() == 1000);
+    REQUIRE(std::equal(l.begin(), l.end(), all.begin()));
+    REQUIRE(std::equal(r.begin(), r.end(), all.begin() + l.size()));
+    REQUIRE((l.empty() || GETT(l.back())->v < key));
+    REQUIRE((r.empty() || GETT(r.front())->v >= key));
+
+    tp.append(right);
+    REQUIRE(right.empty());
+    REQUIRE(heap_ordered(tp.root));
+    REQUIRE(nodes(tp) == all);
+  }
+
+  // shards split off one after the other and appended back in order
+  std::vector<intrusive_treap> shards(4);
+  for (int32_t i = 3; i > 0; i--) {
+    tp.split(i * 125, compareKey, shards[i]);
+  }
+  shards[0].append(tp);
+  REQUIRE(tp.empty());
+  REQUIRE(shards[1].size() == 250);
+  for (int32_t i = 1; i < 4; i++) {
+    shards[0].append(shards[i]);
+  }
+  REQUIRE(nodes(shards[0]) == all);
+  REQUIRE(heap_ordered(shards[0].root));
+}
+
+TEST_CASE("intrusive treap set operations", "[]") {
+  // a holds the multiples of 2 below 600, b those of 3, both inserted in a scrambled order
+  std::vector<T> as, bs;
+  as.reserve(300);
+  bs.reserve(200);
+  for (int32_t i = 0; i < 300; i++) {
+    as.emplace_back(i * 7 % 300 * 2);
+  }
+  for (int32_t i = 0; i < 200; i++) {
+    bs.emplace_back(i * 7 % 200 * 3);
+  }
+
+  for (unsigned threads : {1, 4}) {
+    for (int op = 0; op < 3; op++) {
+      intrusive_treap a, b;
+      for (auto& t : as) {
+        a.insert(&t.node, compareT);
+      }
+      for (auto& t : bs) {
+        b.insert(&t.node, compareT);
+      }
+      std::mutex mutex;
+      std::vector<TREE*> dropped;
+      auto dispose = [&mutex, &dropped](TREE* t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropped.push_back(t);
+      };
+
+      std::vector<int32_t> expected;
+      for (int32_t v = 0; v < 600; v++) {
+        bool ina = v % 2 == 0;
+        bool inb = v % 3 == 0;
+        if ((op == 0 && (ina || inb)) || (op == 1 && ina && inb) || (op == 2 && ina && !inb)) {
+          expected.push_back(v);
+        }
+      }
+      if (op == 0) {
+        a.unite(b, compareT, dispose, threads);
+      } else if (op == 1) {
+        a.intersect(b, compareT, dispose, threads);
+      } else {
+        a.subtract(b, compareT, dispose, threads);
+      }
+      REQUIRE(b.empty());
+      REQUIRE(heap_ordered(a.root));
+
+      std::vector<int32_t> values;
+      bool mine = true; // equal keys keep the node of a
+      a.iterate_inorder(
+          [&values, &mine, &as](TREE* t) {
+            values.push_back(GETT(t)->v);
+            mine = mine && (GETT(t)->v % 2 != 0 || (GETT(t) >= &as[0] && GETT(t) < &as[0] + as.size()));
+          },
+          a.root);
+      REQUIRE(values == expected);
+      REQUIRE(mine);
+      REQUIRE(values.size() + dropped.size() == 500);
+      bool reset = true;
+      for (TREE* t : dropped) {
+        reset = reset && TREE_EMPTY(t);
+      }
+      REQUIRE(reset);
+    }
+  }
+}
+
+TEST_CASE("intrusive bst morris", "[]") {
+  std::vector<T> vs;
+  vs.reserve(1000);
+  for (int32_t i = 0; i < 1000; i++) {
+    vs.emplace_back(i * 7 % 1000);
+  }
+  intrusive_rbtree rb;
+  for (auto& t : vs) {
+    rb.insert(&t.node, compareT);
+  }
+
+  // every link, tag bits included, exactly as it was
+  auto links = [&vs]() {
+    std::vector<void*> v;
+    for (auto& t : vs) {
+      v.push_back(TREE_LEFT(&t.node));
+      v.push_back(TREE_RIGHT(&t.node));
+    }
+    return v;
+  };
+  std::vector<void*> before = links();
+
+  auto collect = [](TREE* t, std::vector<int32_t>& v) {
+    v.push_back(GETT(t)->v);
+    return true;
+  };
+  std::vector<int32_t> inorder;
+  std::vector<int32_t> morris;
+  rb.iterate(TREE_TRAVERSE_INORDER, collect, std::ref(inorder));
+  rb.iterate_morris(collect, rb.root, std::ref(morris));
+  REQUIRE(morris == inorder);
+  REQUIRE(links() == before);
+  REQUIRE(black_height(rb.root) > 0);
+
+  // stopping anywhere leaves no thread behind
+  for (size_t stop : {1, 2, 10, 333, 999}) {
+    size_t count = 0;
+    rb.iterate_morris([&count, stop](TREE* t) { return ++count < stop; }, rb.root);
+    REQUIRE(count == stop);
+    REQUIRE(links() == before);
+  }
+
+  T ts[] = {{2}, {1}, {3}};
+  intrusive_bst bst;
+  for (auto& t : ts) {
+    bst.insert(&t.node, compareT);
+  }
+  morris.clear();
+  bst.iterate_morris(collect, bst.root, std::ref(morris));
+  REQUIRE(equal(morris, {1, 2, 3}));
+  REQUIRE(TREE_EMPTY(&ts[1].node));
+  REQUIRE(TREE_EMPTY(&ts[2].node));
+}
+
+struct S {
+  int32_t v;
+  OSTREE node;
+  S(int32_t i) : v(i) { OSTREE_INIT(&node); }
+};
+
+#define GETS(x) TREE_DATA(x, S, node)
+
+bool compareS(TREE* t1, TREE* t2) { return GETS(t1)->v < GETS(t2)->v; }
+int compareSKey(int32_t k, TREE* t) { return k < GETS(t)->v ? -1 : (k > GETS(t)->v ? 1 : 0); }
+
+TEST_CASE("intrusive ostree", "[]") {
+  const int32_t n = 1000;
+  std::vector<S> ss;
+  ss.reserve(n);
+  for (int32_t i = 0; i < n; i++) {
+    ss.emplace_back(i * 7 % n);
+  }
+
+  intrusive_ostree os;
+  REQUIRE(os.size() == 0);
+  REQUIRE(os.select(0) == nullptr);
+  for (auto& s : ss) {
+    os.insert(OSTREE_NODE(&s.node), compareS);
+  }
+  REQUIRE(os.size() == size_t(n));
+  REQUIRE(black_height(os.root) > 0);
+
+  bool ranked = true;
+  for (int32_t i = 0; i < n; i++) {
+    ranked = ranked && GETS(os.select(i))->v == i && os.rank(i, compareSKey) == size_t(i);
+  }
+  REQUIRE(ranked);
+  REQUIRE(os.select(n) == nullptr);
+  REQUIRE(os.rank(n + 5, compareSKey) == size_t(n));
+  REQUIRE(GETS(os.select(os.size() * 99 / 100))->v == 990);
+
+  for (int32_t i = 0; i < n; i += 2) {
+    S x{i};
+    REQUIRE(os.erase(OSTREE_NODE(&x.node), compareS) != nullptr);
+  }
+  REQUIRE(os.size() == size_t(n / 2));
+  REQUIRE(black_height(os.root) > 0);
+
+  bool counted = true;
+  os.iterate(TREE_TRAVERSE_POSTORDER, [&counted](TREE* t) {
+    TREE* l = intrusive_bst::child(t, 0);
+    TREE* r = intrusive_bst::child(t, 1);
+    counted = counted && OSTREE_SIZE(t) == 1 + (l ? OSTREE_SIZE(l) : 0) + (r ? OSTREE_SIZE(r) : 0);
+  });
+  REQUIRE(counted);
+
+  ranked = true;
+  for (int32_t i = 0; i < n / 2; i++) {
+    ranked = ranked && GETS(os.select(i))->v == 2 * i + 1;
+  }
+  REQUIRE(ranked);
+  REQUIRE(os.rank(10, compareSKey) == 5);
+  REQUIRE(os.rank(11, compareSKey) == 5);
+}
+
+// queued and indexed at once
+struct QT {
+  int32_t v;
+  QUEUE link;
+  TREE node;
+  QT(int32_t i) : v(i) { QUEUE_INIT(&link); }
+};
+
+TEST_CASE("intrusive bst build", "[]") {
+  for (size_t n : {0, 1, 2, 3, 7, 8, 1000, 1023}) {
+    std::vector<T> vs;
+    vs.reserve(n);
+    std::vector<TREE*> ts;
+    for (size_t i = 0; i < n; i++) {
+      vs.emplace_back(int32_t(i));
+      ts.push_back(&vs[i].node);
+    }
+    size_t h = 0;
+    while ((size_t(1) << h) <= n) {
+      h++;
+    }
+
+    intrusive_bst bst;
+    bst.build(ts.data(), n);
+    REQUIRE(bst.size() == n);
+    REQUIRE(bst.height() == h);
+    std::vector<TREE*> order;
+    bst.iterate(TREE_TRAVERSE_INORDER, [&order](TREE* t) { order.push_back(t); });
+    REQUIRE(order == ts);
+
+    intrusive_rbtree rb;
+    rb.build(ts.data(), n);
+    REQUIRE(rb.height() == h);
+    REQUIRE(black_height(rb.root) > 0);
+    REQUIRE((rb.empty() || !RBTREE_RED(rb.root)));
+    T x{int32_t(n)};
+    rb.insert(&x.node, compareT);
+    REQUIRE(black_height(rb.root) > 0);
+    REQUIRE(rb.max(rb.root) == &x.node);
+  }
+
+  // straight from a sorted queue
+  std::vector<QT> qs;
+  qs.reserve(100);
+  intrusive_queue q;
+  for (int32_t i = 0; i < 100; i++) {
+    qs.emplace_back(i);
+    q.enqueue_back(&qs[i].link);
+  }
+  intrusive_bst bst;
+  bst.build(q.begin(), q.size(), [](QUEUE* x) { return &QUEUE_DATA(x, QT, link)->node; });
+  REQUIRE(bst.height() == 7);
+  TREE* found = bst.find(42, [](int32_t k, TREE* t) { return k - TREE_DATA(t, QT, node)->v; });
+  REQUIRE(TREE_DATA(found, QT, node) == &qs[42]);
+  REQUIRE(q.size() == 100);
+
+  // sizes come out right too
+  std::vector<S> ss;
+  ss.reserve(100);
+  std::vector<TREE*> ts;
+  for (int32_t i = 0; i < 100; i++) {
+    ss.emplace_back(i);
+    ts.push_back(OSTREE_NODE(&ss[i].node));
+  }
+  intrusive_ostree os;
+  os.build(ts.data(), ts.size());
+  REQUIRE(os.size() == 100);
+  REQUIRE(os.select(37) == OSTREE_NODE(&ss[37].node));
+  REQUIRE(os.rank(60, compareSKey) == 60);
+}
+
+TEST_CASE("intrusive bst insert hint", "[]") {
+  size_t compares = 0;
+  auto counted = [&compares](TREE* t1, TREE* t2) {
+    compares++;
+    return compareT(t1, t2);
+  };
+  auto values = [](const intrusive_bst::iterator& b, const intrusive_bst::iterator& e) {
+    std::vector<int32_t> v;
+    for (auto i = b; i != e; ++i) {
+      v.push_back(GETT(*i)->v);
+    }
+    return v;
+  };
+
+  // right hints, wrong hints and end(), duplicates included
+  const int32_t n = 1000;
+  std::vector<T> vs;
+  vs.reserve(n);
+  std::vector<int32_t> expect;
+  intrusive_bst bst;
+  intrusive_rbtree rb;
+  std::vector<T> ws;
+  ws.reserve(n);
+  for (int32_t i = 0; i < n; i++) {
+    int32_t v = (i * 7919) % 509;
+    vs.emplace_back(v);
+    ws.emplace_back(v);
+    expect.insert(std::upper_bound(expect.begin(), expect.end(), v), v);
+    intrusive_bst::iterator hint = bst.end();
+    if (i % 3 == 0) {
+      hint = bst.begin(v, compareKey);
+    } else if (i % 3 == 1) {
+      hint = bst.begin((v * 31) % 509, compareKey);
+    }
+    compares = 0;
+    bst.insert_hint(hint, &vs[i].node, counted);
+    if (i % 3 == 0) {
+      REQUIRE(compares <= 2);
+    }
+    rb.insert_hint(i % 2 ? rb.begin(v, compareKey) : rb.begin(v / 2, compareKey), &ws[i].node, compareT);
+    REQUIRE(black_height(rb.root) > 0);
+  }
+  REQUIRE(values(bst.begin(), bst.end()) == expect);
+  REQUIRE(values(rb.begin(), rb.end()) == expect);
+
+  // the hint is used in place, a chain hinted at end() takes no heap
+  intrusive_bst chain;
+  size_t before = tree_mallocs;
+  for (auto& v : vs) {
+    TREE_INIT(&v.node);
+  }
+  for (int32_t i = 0; i < n; i++) {
+    vs[i].v = i;
+    chain.insert_hint(chain.end(), &vs[i].node, compareT);
+  }
+  REQUIRE(tree_mallocs == before);
+  REQUIRE(chain.height() == size_t(n));
+  intrusive_bst::iterator at = chain.begin();
+  T mid{-1};
+  chain.insert_hint(at, &mid.node, compareT);
+  REQUIRE(*at == &mid.node);
+  REQUIRE(*++at == &vs[0].node);
+
+  // a run in order, then one out of order now and then
+  for (int32_t m : {1, 2, 3, 100, 1000}) {
+    std::vector<T> xs;
+    xs.reserve(m);
+    std::vector<T> ys;
+    ys.reserve(m);
+    std::vector<int32_t> in;
+    intrusive_bst b;
+    intrusive_rbtree r;
+    intrusive_bst::iterator lb = b.end();
+    intrusive_rbtree::iterator lr = r.end();
+    for (int32_t i = 0; i < m; i++) {
+      int32_t v = i % 10 == 9 ? i - 5 : i;
+      xs.emplace_back(v);
+      ys.emplace_back(v);
+      in.insert(std::upper_bound(in.begin(), in.end(), v), v);
+      if (lb == b.end() || !compareT(&xs[i].node, *lb)) {
+        compares = 0;
+        b.insert_max(lb, &xs[i].node);
+        r.insert_max(lr, &ys[i].node);
+        REQUIRE(compares == 0);
+        REQUIRE(*lb == &xs[i].node);
+        REQUIRE(*lr == &ys[i].node);
+        REQUIRE(r.max(r.root) == &ys[i].node);
+      } else {
+        b.insert_hint(lb, &xs[i].node, compareT);
+        r.insert_hint(lr, &ys[i].node, compareT);
+        lb = --b.end();
+        lr = r.end();
+      }
+      REQUIRE(black_height(r.root) > 0);
+    }
+    REQUIRE(values(b.begin(), b.end()) == in);
+    REQUIRE(values(r.begin(), r.end()) == in);
+  }
+
+  // summaries kept up to date
+  std::vector<S> ss;
+  ss.reserve(500);
+  intrusive_ostree os;
+  intrusive_ostree::iterator last = os.end();
+  for (int32_t i = 0; i < 500; i++) {
+    ss.emplace_back(i);
+    os.insert_max(last, OSTREE_NODE(&ss[i].node));
+  }
+  REQUIRE(os.size() == 500);
+  REQUIRE(black_height(os.root) > 0);
+  REQUIRE(os.select(321) == OSTREE_NODE(&ss[321].node));
+  REQUIRE(os.rank(100, compareSKey) == 100);
+}
+
+int orderT(TREE* t1, TREE* t2) { return GETT(t1)->v < GETT(t2)->v ? -1 : (GETT(t1)->v > GETT(t2)->v ? 1 : 0); }
+
+// a C style less, 0 or 1
+int lessIntT(TREE* t1, TREE* t2) { return GETT(t1)->v < GETT(t2)->v; }
+
+TEST_CASE("intrusive bst insert unique", "[]") {
+  REQUIRE(!tree_three_way<TREE_LESS_T>::value);
+  REQUIRE(!tree_three_way<TREE_COMPARE_T>::value);
+  REQUIRE(tree_three_way<decltype(tree_compare(orderT))>::value);
+
+  size_t compares = 0;
+  auto less = [&compares](TREE* t1, TREE* t2) {
+    compares++;
+    return compareT(t1, t2);
+  };
+  auto order = tree_compare([&compares](TREE* t1, TREE* t2) {
+    compares++;
+    return orderT(t1, t2);
+  });
+
+  // every key twice, the second copy is turned away with the first returned
+  const int32_t n = 500;
+  std::vector<T> vs;
+  vs.reserve(4 * n);
+  for (int32_t i = 0; i < 4 * n; i++) {
+    vs.emplace_back((i * 7919) % n);
+  }
+  intrusive_bst bst;
+  intrusive_rbtree rb;
+  for (int32_t i = 0; i < 2 * n; i++) {
+    TREE* t = &vs[i].node;
+    TREE* u = &vs[2 * n + i].node;
+    TREE* first = i < n ? t : &vs[i - n].node;
+    compares = 0;
+    size_t depth = bst.height();
+    REQUIRE(bst.insert_unique(t, less) == first);
+    REQUIRE(compares <= depth + 1);
+    compares = 0;
+    depth = rb.height();
+    REQUIRE(rb.insert_unique(u, order) == (i < n ? u : &vs[2 * n + i - n].node));
+    REQUIRE(compares <= depth);
+    REQUIRE(black_height(rb.root) > 0);
+  }
+  REQUIRE(bst.size() == size_t(n));
+  REQUIRE(rb.size() == size_t(n));
+  int32_t expect = 0;
+  bool sorted = true;
+  rb.iterate(TREE_TRAVERSE_INORDER, [&](TREE* t) { sorted = sorted && GETT(t)->v == expect++; });
+  REQUIRE(sorted);
+
+  // erase takes either kind, one compare a level with a three-way one
+  for (int32_t i = 0; i < n; i += 2) {
+    T x{i};
+    compares = 0;
+    size_t depth = rb.height();
+    REQUIRE(GETT(rb.erase(&x.node, order))->v == i);
+    REQUIRE(compares <= depth);
+    REQUIRE(GETT(bst.erase(&x.node, order))->v == i);
+    REQUIRE(rb.erase(&x.node, order) == nullptr);
+    REQUIRE(rb.insert_unique(&x.node, tree_compare(orderT)) == &x.node);
+    REQUIRE(rb.erase(&x.node, compareT) == &x.node);
+  }
+  REQUIRE(rb.size() == size_t(n / 2));
+  REQUIRE(bst.size() == size_t(n / 2));
+  REQUIRE(black_height(rb.root) > 0);
+
+  T ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  T t3{3};
+  intrusive_avltree avl;
+  intrusive_treap treap;
+  intrusive_splaytree splay;
+  for (auto& t : ts) {
+    avl.insert(&t.node, compareT);
+  }
+  REQUIRE(avl.erase(&t3.node, tree_compare(orderT)) == &ts[3].node);
+  for (auto& t : ts) {
+    TREE_INIT(&t.node);
+    treap.insert(&t.node, compareT);
+  }
+  REQUIRE(treap.erase(&t3.node, tree_compare(orderT)) == &ts[3].node);
+  for (auto& t : ts) {
+    splay.insert(&t.node, compareT);
+  }
+  REQUIRE(splay.erase(&t3.node, tree_compare(orderT)) == &ts[3].node);
+  REQUIRE(splay.erase(&t3.node, tree_compare(orderT)) == nullptr);
+
+  // an int returning less is still a less, for erase and insert_unique too
+  T us[] = {{5}, {1}, {9}, {3}, {7}};
+  T u5{5};
+  intrusive_bst ub;
+  intrusive_rbtree ur;
+  for (auto& u : us) {
+    REQUIRE(ub.insert_unique(&u.node, lessIntT) == &u.node);
+  }
+  REQUIRE(ub.insert_unique(&u5.node, lessIntT) == &us[0].node);
+  REQUIRE(ub.erase(&u5.node, lessIntT) == &us[0].node);
+  REQUIRE(ub.erase(&u5.node, lessIntT) == nullptr);
+  for (auto& u : us) {
+    TREE_INIT(&u.node);
+    ur.insert(&u.node, lessIntT);
+  }
+  std::vector<int32_t> in;
+  ur.iterate(TREE_TRAVERSE_INORDER, [&in](TREE* t) { in.push_back(GETT(t)->v); });
+  REQUIRE(in == std::vector<int32_t>{1, 3, 5, 7, 9});
+  REQUIRE(ur.erase(&u5.node, lessIntT) == &us[0].node);
+  REQUIRE(ur.erase(&us[1].node, tree_compare(orderT)) == &us[1].node);
+  in.clear();
+  ur.iterate(TREE_TRAVERSE_INORDER, [&in](TREE* t) { in.push_back(GETT(t)->v); });
+  REQUIRE(in == std::vector<int32_t>{3, 7, 9});
+
+  // the typed view
+  intrusive_tree<TREE_MEMBER(T, node), lessT, intrusive_rbtree> tree;
+  T a{7}, b{7}, c{8};
+  REQUIRE(tree.insert_unique(&a) == &a);
+  REQUIRE(tree.insert_unique(&b) == &a);
+  REQUIRE(tree.insert_unique(&c) == &c);
+  REQUIRE(tree.size() == 2);
+}
+
+struct PT {
+  int32_t v;
+  PTREE node;
+  PT(int32_t i) : v(i) { PTREE_INIT(&node); }
+};
+
+#define GETPT(x) TREE_DATA(x, PT, node)
+
+bool comparePT(TREE* t1, TREE* t2) { return GETPT(t1)->v < GETPT(t2)->v; }
+
+// the parent links agree with the child links
+bool parents(TREE* t, TREE* parent) {
+  if (t == nullptr) {
+    return true;
+  }
+  return PTREE_PARENT(t) == parent && parents(intrusive_bst::child(t, 0), t) && parents(intrusive_bst::child(t, 1), t);
+}
+
+TEST_CASE("intrusive prbtree", "[]") {
+  // ten of each key, erased by node in an order of their own
+  const int32_t n = 1000;
+  std::vector<PT> ps;
+  ps.reserve(n);
+  for (int32_t i = 0; i < n; i++) {
+    ps.emplace_back(i % 100);
+  }
+  size_t compares = 0;
+  auto counted = [&compares](TREE* t1, TREE* t2) {
+    compares++;
+    return comparePT(t1, t2);
+  };
+  intrusive_prbtree tree;
+  for (auto& p : ps) {
+    tree.insert(PTREE_NODE(&p.node), counted);
+    REQUIRE(black_height(tree.root) > 0);
+  }
+  REQUIRE(tree.size() == size_t(n));
+  REQUIRE(parents(tree.root, nullptr));
+  REQUIRE(PTREE_PARENT(tree.root) == nullptr);
+
+  // equal nodes stay in insertion order, stepped through without a comparison
+  compares = 0;
+  std::vector<PT*> in;
+  for (TREE* t = tree.min(tree.root); t != nullptr; t = intrusive_prbtree::next(t)) {
+    in.push_back(GETPT(t));
+  }
+  REQUIRE(in.size() == size_t(n));
+  REQUIRE(in[0] == &ps[0]);
+  REQUIRE(in[1] == &ps[100]);
+  REQUIRE(in[9] == &ps[900]);
+  REQUIRE(in[10] == &ps[1]);
+  REQUIRE(intrusive_prbtree::prev(PTREE_NODE(&ps[100].node)) == PTREE_NODE(&ps[0].node));
+  REQUIRE(intrusive_prbtree::prev(PTREE_NODE(&ps[0].node)) == nullptr);
+  REQUIRE(intrusive_prbtree::next(PTREE_NODE(&ps[999].node)) == nullptr);
+
+  for (int32_t i = 0; i < n; i++) {
+    PT* p = &ps[(i * 7919) % n];
+    REQUIRE(tree.erase(PTREE_NODE(&p->node)) == PTREE_NODE(&p->node));
+    REQUIRE(TREE_EMPTY(PTREE_NODE(&p->node)));
+    REQUIRE(PTREE_PARENT(PTREE_NODE(&p->node)) == nullptr);
+    if (i % 50 == 0) {
+      REQUIRE(black_height(tree.root) > 0);
+      REQUIRE(parents(tree.root, nullptr));
+      REQUIRE(tree.size() == size_t(n - i - 1));
+    }
+  }
+  REQUIRE(compares == 0);
+  REQUIRE(tree.empty());
+
+  // by key as well
+  PT ts[] = {{4}, {2}, {1}, {3}, {0}, {5}};
+  for (auto& t : ts) {
+    tree.insert(PTREE_NODE(&t.node), comparePT);
+  }
+  PT t3{3}, t7{7};
+  REQUIRE(tree.erase(PTREE_NODE(&t3.node), comparePT) == PTREE_NODE(&ts[3].node));
+  REQUIRE(tree.erase(PTREE_NODE(&t7.node), comparePT) == nullptr);
+  REQUIRE(tree.size() == 5);
+  REQUIRE(parents(tree.root, nullptr));
+}
+
+struct IT {
+  int32_t id;
+  ITREE node;
+  IT(int32_t i, uint64_t lo, uint64_t hi) : id(i) { ITREE_INIT(&node, lo, hi); }
+};
+
+#define GETIT(x) TREE_DATA(x, IT, node)
+
+// every subtree keeps the largest hi below it
+bool maxed(TREE* t) {
+  if (t == nullptr) {
+    return true;
+  }
+  TREE* l = intrusive_bst::child(t, 0);
+  TREE* r = intrusive_bst::child(t, 1);
+  uint64_t m = std::max(ITREE_HIGH(t), std::max(itree_augment::max(l), itree_augment::max(r)));
+  return ITREE_MAX(t) == m && maxed(l) && maxed(r);
+}
+
+TEST_CASE("intrusive itree", "[]") {
+  IT is[] = {{0, 5, 10}, {1, 0, 3}, {2, 8, 9}, {3, 15, 20}, {4, 2, 30}, {5, 5, 10}};
+  intrusive_itree tree;
+  REQUIRE(tree.find_overlap(0, 100) == nullptr);
+  for (auto& i : is) {
+    tree.insert(ITREE_NODE(&i.node));
+  }
+  REQUIRE(tree.size() == 6);
+  REQUIRE(ITREE_MAX(tree.root) == 30);
+  REQUIRE(maxed(tree.root));
+
+  auto overlaps = [&tree](uint64_t a, uint64_t b) {
+    std::vector<int32_t> v;
+    tree.iterate_overlaps(a, b, [&v](TREE* t) { v.push_back(GETIT(t)->id); });
+    return v;
+  };
+  REQUIRE(equal(overlaps(3, 5), {4}));
+  REQUIRE(equal(overlaps(9, 10), {4, 0, 5}));
+  REQUIRE(overlaps(0, 1) == std::vector<int32_t>{1});
+  REQUIRE(overlaps(30, 40).empty());
+  REQUIRE(overlaps(7, 7).empty());
+  REQUIRE(tree.find_overlap(30, 40) == nullptr);
+  REQUIRE(tree.find_overlap(19, 20) != nullptr);
+
+  // equal intervals are told apart by address
+  REQUIRE(tree.erase(ITREE_NODE(&is[5].node)) == ITREE_NODE(&is[5].node));
+  REQUIRE(tree.erase(ITREE_NODE(&is[5].node)) == nullptr);
+  REQUIRE(tree.erase(ITREE_NODE(&is[4].node)) == ITREE_NODE(&is[4].node));
+  REQUIRE(ITREE_MAX(tree.root) == 20);
+  REQUIRE(maxed(tree.root));
+  REQUIRE(equal(overlaps(9, 10), {0}));
+
+  // against a scan, ranges of all widths
+  const int32_t n = 2000;
+  std::vector<IT> vs;
+  vs.reserve(n);
+  intrusive_itree big;
+  for (int32_t i = 0; i < n; i++) {
+    uint64_t lo = uint64_t(i * 7919) % 10007;
+    vs.emplace_back(i, lo, lo + 1 + uint64_t(i * 104729) % (i % 10 == 0 ? 2000 : 20));
+    big.insert(ITREE_NODE(&vs[i].node));
+  }
+  REQUIRE(maxed(big.root));
+  REQUIRE(black_height(big.root) > 0);
+  for (int32_t q = 0; q < 200; q++) {
+    uint64_t a = uint64_t(q * 1543) % 10100;
+    uint64_t b = a + uint64_t(q % 7) * 13;
+    if (q % 3 == 0) {
+      REQUIRE(big.erase(ITREE_NODE(&vs[q * 5].node)) == ITREE_NODE(&vs[q * 5].node));
+    }
+    std::vector<TREE*> scan;
+    big.iterate(TREE_TRAVERSE_INORDER, [&](TREE* t) {
+      if (a < b && ITREE_LOW(t) < b && a < ITREE_HIGH(t)) {
+        scan.push_back(t);
+      }
+    });
+    std::vector<TREE*> found;
+    big.iterate_overlaps(a, b, [&found](TREE* t) { found.push_back(t); });
+    REQUIRE(found == scan);
+    TREE* any = big.find_overlap(a, b);
+    REQUIRE((any == nullptr) == scan.empty());
+    REQUIRE((any == nullptr || std::find(scan.begin(), scan.end(), any) != scan.end()));
+  }
+  REQUIRE(maxed(big.root));
+}
+
+struct MT {
+  uint64_t key;
+  uint64_t bytes;
+  TREE node;
+  struct summary {
+    uint64_t bytes;
+    uint64_t h, p; // polynomial hash of the keys in order and the power it shifts by, sees order unlike bytes
+  } sum;
+
+  MT(uint64_t k = 0, uint64_t b = 0) : key(k), bytes(b) {}
+};
+
+#define GETMT(x) TREE_DATA(x, MT, node)
+
+struct MTS {
+  typedef MT::summary type;
+  static type identity() { return type{0, 0, 1}; }
+  static type combine(const type& l, const type& r) { return type{l.bytes + r.bytes, l.h * r.p + r.h, l.p * r.p}; }
+  static type value(TREE* t) { return type{GETMT(t)->bytes, GETMT(t)->key, 1000003}; }
+  static type& sum(TREE* t) { return GETMT(t)->sum; }
+};
+
+int orderMT(uint64_t key, TREE* t) { return key < GETMT(t)->key ? -1 : (key > GETMT(t)->key ? 1 : 0); }
+bool compareMT(TREE* t1, TREE* t2) { return GETMT(t1)->key < GETMT(t2)->key; }
+
+TEST_CASE("intrusive mtree", "[]") {
+  intrusive_mtree<MTS> tree;
+  REQUIRE(tree.aggregate().bytes == 0);
+  REQUIRE(tree.aggregate(0, 100, orderMT).bytes == 0);
+  MT ms[] = {{40, 4}, {20, 2}, {10, 1}, {30, 3}, {50, 5}, {30, 30}};
+  for (auto& m : ms) {
+    tree.insert(&m.node, compareMT);
+  }
+  REQUIRE(tree.aggregate().bytes == 45);
+  REQUIRE(tree.aggregate(20, 41, orderMT).bytes == 39);
+  REQUIRE(tree.aggregate(30, 31, orderMT).bytes == 33);
+  REQUIRE(tree.aggregate(0, 10, orderMT).bytes == 0);
+  REQUIRE(tree.aggregate(51, 60, orderMT).bytes == 0);
+  REQUIRE(tree.aggregate(40, 20, orderMT).bytes == 0);
+  MT m30{30, 0};
+  REQUIRE(tree.erase(&m30.node, compareMT) != nullptr);
+  REQUIRE(tree.aggregate(0, 100, orderMT).bytes == tree.aggregate().bytes);
+  REQUIRE((tree.aggregate().bytes == 42 || tree.aggregate().bytes == 15));
+
+  // against a scan, random inserts and erases, the hash checks the order things are combined in
+  const uint64_t n = 3000;
+  std::vector<MT> vs(n);
+  intrusive_mtree<MTS> big;
+  for (uint64_t i = 0; i < n; i++) {
+    vs[i].key = i * 7919 % 5003;
+    vs[i].bytes = i * 104729 % 1000;
+    big.insert(&vs[i].node, compareMT);
+  }
+  REQUIRE(black_height(big.root) > 0);
+  for (uint64_t q = 0; q < 300; q++) {
+    if (q % 2 == 0) {
+      REQUIRE(big.erase(&vs[q * 7].node, compareMT) != nullptr);
+    }
+    uint64_t lo = q * 1543 % 5100;
+    uint64_t hi = lo + q % 11 * 97;
+    MTS::type scan = MTS::identity();
+    big.iterate_range(lo, hi, orderMT, [&scan](TREE* t) { scan = MTS::combine(scan, MTS::value(t)); });
+    MTS::type s = big.aggregate(lo, hi, orderMT);
+    REQUIRE(s.bytes == scan.bytes);
+    REQUIRE(s.h == scan.h);
+    REQUIRE(s.p == scan.p);
+  }
+  MTS::type all = MTS::identity();
+  big.iterate(TREE_TRAVERSE_INORDER, [&all](TREE* t) { all = MTS::combine(all, MTS::value(t)); });
+  REQUIRE(big.aggregate().h == all.h);
+}
+
+TEST_CASE("intrusive frozen", "[]") {
+  auto key = [](TREE* t) { return GETT(t)->v; };
+  auto order = [](int32_t k, TREE* t) { return k - GETT(t)->v; };
+  frozen_tree<int32_t> frozen;
+  REQUIRE(frozen.empty());
+  REQUIRE(frozen.lower_bound(0) == nullptr);
+  REQUIRE(frozen.upper_bound(0) == nullptr);
+  REQUIRE(frozen.find(0) == nullptr);
+  intrusive_rbtree tree;
+  frozen.freeze(tree, key);
+  REQUIRE(frozen.empty());
+  REQUIRE(frozen.lower_bound(0) == nullptr);
+  REQUIRE(frozen.upper_bound(0) == nullptr);
+  REQUIRE(frozen.find(0) == nullptr);
+
+  // every size up to a few full levels, odd keys with runs of equal ones, asked every key around them
+  std::vector<T> ts;
+  ts.reserve(200);
+  for (int32_t n = 1; n <= 200; n++) {
+    ts.emplace_back(2 * (n / 3) + 1);
+    tree.insert(&ts.back().node, compareT);
+    frozen.freeze(tree, key);
+    REQUIRE(frozen.size() == size_t(n));
+    for (int32_t k = -1; k <= 2 * (n / 3) + 2; k++) {
+      TREE* lo = tree.lower_bound(k, order);
+      REQUIRE(frozen.lower_bound(k) == lo);
+      REQUIRE(frozen.upper_bound(k) == tree.upper_bound(k, order));
+      REQUIRE(frozen.find(k) == (lo != nullptr && GETT(lo)->v == k ? lo : nullptr));
+    }
+  }
+
+  // a snapshot knows nothing of later changes
+  TREE* first = tree.min(tree.root);
+  tree.erase(first, compareT);
+  REQUIRE(frozen.find(1) == first);
+
+  frozen_tree<int32_t, std::greater<int32_t>> reversed;
+  intrusive_bst down;
+  T ds[] = {{3}, {1}, {2}};
+  for (auto& d : ds) {
+    down.insert(&d.node, [](TREE* t1, TREE* t2) { return GETT(t1)->v > GETT(t2)->v; });
+  }
+  reversed.freeze(down, key);
+  REQUIRE(reversed.lower_bound(4) == &ds[0].node);
+  REQUIRE(reversed.find(2) == &ds[2].node);
+  REQUIRE(reversed.upper_bound(1) == nullptr);
+}
+
+struct BT {
+  int32_t v;
+  BPTREE hook;
+  BT(int32_t i = 0) : v(i) { BPTREE_INIT(&hook); }
+};
+
+#define GETBT(x) TREE_DATA(x, BT, hook)
+
+typedef intrusive_bptree<int32_t, std::less<int32_t>, 4> bptree4;
+
+// every node below its parent, half full unless it is the root and n keys within the bounds its parent gives it, all
+// leaves at one depth, chained in order and pointed to by the hooks of what they hold, returns how many objects there
+// are below p
+size_t linked(const bptree4& tree, bptree4::node* p, unsigned depth, const int32_t* lo, const int32_t* hi,
+              bptree4::leaf*& last) {
+  if (depth + 1 == tree.levels) {
+    bptree4::leaf* l = static_cast<bptree4::leaf*>(p);
+    REQUIRE(l->n >= (p == tree.root ? 1u : 2u));
+    REQUIRE(l->prev == last);
+    REQUIRE((last == nullptr ? tree.head : last->next) == l);
+    for (unsigned i = 0; i < l->n; i++) {
+      REQUIRE(BPTREE_LEAF(l->items[i]) == l);
+      REQUIRE(GETBT(l->items[i])->v == l->keys[i]);
+      REQUIRE((i == 0 || l->keys[i - 1] <= l->keys[i]));
+      REQUIRE((lo == nullptr || *lo <= l->keys[i]));
+      REQUIRE((hi == nullptr || l->keys[i] <= *hi));
+    }
+    last = l;
+    return l->n;
+  }
+  bptree4::inner* in = static_cast<bptree4::inner*>(p);
+  REQUIRE(in->n >= 2u);
+  size_t n = 0;
+  for (unsigned j = 0; j < in->n; j++) {
+    REQUIRE(in->children[j]->parent == in);
+    const int32_t* l = j > 0 ? &in->keys[j - 1] : lo;
+    const int32_t* h = j + 1 < in->n ? &in->keys[j] : hi;
+    n += linked(tree, in->children[j], depth + 1, l, h, last);
+  }
+  return n;
+}
+
+bool linked(const bptree4& tree) {
+  bptree4::leaf* last = nullptr;
+  size_t n = tree.empty() ? 0 : linked(tree, tree.root, 0, nullptr, nullptr, last);
+  REQUIRE((last == nullptr ? tree.head : last->next) == nullptr);
+  REQUIRE((tree.root == nullptr || tree.root->parent == nullptr));
+  return n == tree.size();
+}
+
+TEST_CASE("intrusive bptree", "[]") {
+  bptree4 tree;
+  REQUIRE(tree.empty());
+  REQUIRE(tree.find(0) == nullptr);
+  REQUIRE(tree.lower_bound(0) == nullptr);
+  BT bs[] = {{4}, {2}, {1}, {3}, {0}, {5}, {3}};
+  for (auto& b : bs) {
+    tree.insert(&b.hook, b.v);
+  }
+  REQUIRE(tree.size() == 7);
+  REQUIRE(tree.height() == 2);
+  REQUIRE(linked(tree));
+  std::vector<BT*> in;
+  tree.iterate([&in](BPTREE* b) { in.push_back(GETBT(b)); });
+  REQUIRE(in == std::vector<BT*>{&bs[4], &bs[2], &bs[1], &bs[3], &bs[6], &bs[0], &bs[5]});
+  REQUIRE(tree.find(3) == &bs[3].hook);
+  REQUIRE(tree.find(7) == nullptr);
+  REQUIRE(tree.lower_bound(-1) == &bs[4].hook);
+  REQUIRE(tree.upper_bound(3) == &bs[0].hook);
+  REQUIRE(tree.upper_bound(5) == nullptr);
+  size_t k = 0;
+  tree.iterate([&k](BPTREE*) { return ++k < 3; });
+  REQUIRE(k == 3);
+
+  REQUIRE(tree.erase(&bs[3].hook) == &bs[3].hook);
+  REQUIRE(tree.erase(&bs[3].hook) == nullptr);
+  REQUIRE(tree.find(3) == &bs[6].hook);
+  REQUIRE(tree.erase(3) == &bs[6].hook);
+  REQUIRE(tree.erase(3) == nullptr);
+  REQUIRE(linked(tree));
+  for (auto& b : bs) {
+    tree.erase(&b.hook);
+  }
+  REQUIRE(tree.empty());
+  REQUIRE(tree.height() == 0);
+  REQUIRE(tree.head == nullptr);
+
+  // against a sorted copy, runs of equal keys across many splits, erased in an order unrelated to the keys
+  const int32_t n = 3000;
+  std::vector<BT> vs(n);
+  std::vector<std::pair<int32_t, int32_t>> sorted;
+  for (int32_t i = 0; i < n; i++) {
+    vs[i].v = i * 7919 % 1009;
+    tree.insert(&vs[i].hook, vs[i].v);
+    sorted.emplace_back(vs[i].v, i);
+  }
+  std::sort(sorted.begin(), sorted.end());
+  REQUIRE(linked(tree));
+  std::vector<BPTREE*> all;
+  tree.iterate([&all](BPTREE* b) { all.push_back(b); });
+  REQUIRE(all.size() == size_t(n));
+  for (int32_t i = 0; i < n; i++) {
+    REQUIRE(all[i] == &vs[sorted[i].second].hook);
+  }
+  std::vector<bool> present(n, true);
+  for (int32_t q = 0; q < n; q++) {
+    BT& b = vs[q * 1237 % n];
+    if (q % 3 != 0) {
+      REQUIRE(tree.erase(&b.hook) == (present[&b - &vs[0]] ? &b.hook : nullptr));
+      present[&b - &vs[0]] = false;
+    } else {
+      BPTREE* f = tree.find(b.v);
+      REQUIRE(f == tree.lower_bound(b.v));
+      REQUIRE((f == nullptr || GETBT(f)->v == b.v));
+      REQUIRE(tree.erase(b.v) == f);
+      if (f != nullptr) {
+        present[GETBT(f) - &vs[0]] = false;
+      }
+    }
+    if (q % 100 == 0) {
+      REQUIRE(linked(tree));
+      for (int32_t key = -1; key <= 1009; key += 17) {
+        BPTREE* lo = nullptr;
+        BPTREE* hi = nullptr;
+        tree.iterate([&](BPTREE* x) {
+          lo = lo == nullptr && GETBT(x)->v >= key ? x : lo;
+          hi = hi == nullptr && GETBT(x)->v > key ? x : hi;
+        });
+        REQUIRE(tree.lower_bound(key) == lo);
+        REQUIRE(tree.upper_bound(key) == hi);
+      }
+    }
+  }
+  for (int32_t i = 0; i < n; i++) {
+    REQUIRE(tree.erase(&vs[i].hook) == (present[i] ? &vs[i].hook : nullptr));
+  }
+  REQUIRE(tree.empty());
+  REQUIRE(tree.head == nullptr);
+
+  // height follows the size back down, erasing from either end or the middle
+  for (int32_t i = 0; i < n; i++) {
+    vs[i].v = i;
+    tree.insert(&vs[i].hook, i);
+  }
+  size_t peak = tree.height();
+  for (int32_t i = 0; i < n - 8; i++) {
+    int32_t at = i % 3 == 0 ? i / 3 : i % 3 == 1 ? n - 1 - i / 3 : n / 2 + (i / 3 % 2 == 0 ? i / 6 : -1 - i / 6);
+    REQUIRE(tree.erase(&vs[at].hook) == &vs[at].hook);
+    if (i % 97 == 0) {
+      REQUIRE(linked(tree));
+    }
+  }
+  REQUIRE(linked(tree));
+  REQUIRE(tree.size() == 8);
+  REQUIRE(tree.height() <= 3);
+  REQUIRE(tree.height() < peak);
+  tree.clear();
+
+  // what is freed is taken again
+  for (int32_t i = 0; i < n; i++) {
+    tree.insert(&vs[i].hook, vs[i].v);
+  }
+  REQUIRE(linked(tree));
+  tree.clear();
+  REQUIRE(tree.empty());
+  REQUIRE(tree.size() == 0);
+  REQUIRE(tree.erase(&vs[0].hook) == nullptr);
+  REQUIRE(BPTREE_LEAF(&vs[n - 1].hook) == nullptr);
+
+  // nor do hooks outlive the tree
+  {
+    bptree4 scoped;
+    for (auto& b : bs) {
+      scoped.insert(&b.hook, b.v);
+    }
+  }
+  for (auto& b : bs) {
+    REQUIRE(BPTREE_LEAF(&b.hook) == nullptr);
+    REQUIRE(tree.erase(&b.hook) == nullptr);
+  }
+}
+
 struct SQ {
   uint32_t v;
   SLOT_QUEUE q;